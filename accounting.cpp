@@ -0,0 +1,148 @@
+#include "accounting.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include "fiber.h"
+#include "fiber_consumer.h"
+#include "sync.h"
+
+namespace fiber::accounting {
+
+namespace detail {
+std::atomic<bool> enabled{false};
+} // namespace detail
+
+namespace {
+
+
+// 每个consumer一张统计表：只有该consumer线程写入，查询时其他线程加锁读取
+struct alignas(CACHE_LINE_SIZE) ConsumerTable {
+    SpinLock lock;
+    std::unordered_map<uint64_t, Usage> usage;
+};
+
+std::mutex g_mutex;
+std::unique_ptr<ConsumerTable[]> g_tables;
+size_t g_table_count{0};
+
+// 调度器启动（或第一次开启统计）时的时间戳和steady_clock，用于换算周期数
+std::once_flag g_calibration_once;
+uint64_t g_cycles0{0};
+std::chrono::steady_clock::time_point g_time0;
+
+void calibrationStart() {
+    std::call_once(g_calibration_once, [] {
+        g_time0 = std::chrono::steady_clock::now();
+        g_cycles0 = now();
+    });
+}
+
+void merge(std::unordered_map<uint64_t, Usage> &into, ConsumerTable &table) {
+    std::lock_guard guard(table.lock);
+    for (auto &[key, usage]: table.usage) {
+        auto &total = into[key];
+        total.cycles += usage.cycles;
+        total.slices += usage.slices;
+    }
+}
+
+} // namespace
+
+std::chrono::nanoseconds Usage::time() const { return to_duration(cycles); }
+
+void enable(bool on) {
+    if (on) {
+        calibrationStart();
+    }
+    detail::enabled.store(on, std::memory_order_relaxed);
+}
+
+std::chrono::nanoseconds to_duration(uint64_t cycles) {
+#if defined(__x86_64__) || defined(__i386__)
+    // 校准起点在调度器启动时就已经记下，这里只按到目前为止的跨度估算，不能等待：
+    // 调用方可能是consumer上的fiber。跨度越长越准，调度器刚启动的几毫秒内误差较大
+    calibrationStart();
+    const auto elapsed = std::chrono::steady_clock::now() - g_time0;
+    const uint64_t elapsed_cycles = now() - g_cycles0;
+    if (elapsed <= std::chrono::microseconds(1) || elapsed_cycles == 0) {
+        return std::chrono::nanoseconds(cycles);
+    }
+    const double ns_per_cycle = static_cast<double>(std::chrono::nanoseconds(elapsed).count()) /
+                                static_cast<double>(std::max<uint64_t>(elapsed_cycles, 1));
+    return std::chrono::nanoseconds(static_cast<int64_t>(static_cast<double>(cycles) * ns_per_cycle));
+#else
+    return std::chrono::nanoseconds(cycles);
+#endif
+}
+
+std::unordered_map<uint64_t, Usage> snapshot() {
+    std::unordered_map<uint64_t, Usage> result;
+    std::lock_guard guard(g_mutex);
+    for (size_t i = 0; i < g_table_count; ++i) {
+        merge(result, g_tables[i]);
+    }
+    return result;
+}
+
+std::unordered_map<uint64_t, Usage> snapshot(int consumer_id) {
+    std::unordered_map<uint64_t, Usage> result;
+    std::lock_guard guard(g_mutex);
+    if (consumer_id >= 0 && static_cast<size_t>(consumer_id) < g_table_count) {
+        merge(result, g_tables[consumer_id]);
+    }
+    return result;
+}
+
+std::vector<std::pair<uint64_t, Usage>> top(size_t n) {
+    auto merged = snapshot();
+    std::vector<std::pair<uint64_t, Usage>> result(merged.begin(), merged.end());
+    n = std::min(n, result.size());
+    std::partial_sort(result.begin(), result.begin() + static_cast<std::ptrdiff_t>(n), result.end(),
+                      [](const auto &a, const auto &b) { return a.second.cycles > b.second.cycles; });
+    result.resize(n);
+    return result;
+}
+
+void reset() {
+    std::lock_guard guard(g_mutex);
+    for (size_t i = 0; i < g_table_count; ++i) {
+        std::lock_guard table_guard(g_tables[i].lock);
+        g_tables[i].usage.clear();
+    }
+}
+
+void attachConsumers(int count) {
+    // 调度器启动时就开始校准，第一次换算时跨度已经足够长
+    calibrationStart();
+    std::lock_guard guard(g_mutex);
+    if (static_cast<size_t>(count) <= g_table_count) {
+        return;
+    }
+    // 表只增不减：调度器重启时沿用之前的统计
+    auto tables = std::make_unique<ConsumerTable[]>(count);
+    for (size_t i = 0; i < g_table_count; ++i) {
+        tables[i].usage = std::move(g_tables[i].usage);
+    }
+    g_tables = std::move(tables);
+    g_table_count = count;
+}
+
+void charge(const Fiber &fiber, uint64_t cycles) {
+    auto consumer = FiberConsumer::current();
+    if (!consumer) {
+        return;
+    }
+    const auto id = static_cast<size_t>(consumer->id());
+    // consumer运行期间g_tables不会被替换（attachConsumers只在启动consumer前调用），这里不需要g_mutex
+    if (id >= g_table_count) {
+        return;
+    }
+    const uint64_t key = fiber.GetTag() ? fiber.GetTag() : fiber.GetTraceId();
+    auto &table = g_tables[id];
+    std::lock_guard guard(table.lock);
+    auto &usage = table.usage[key];
+    usage.cycles += cycles;
+    ++usage.slices;
+}
+
+} // namespace fiber::accounting
@@ -0,0 +1,345 @@
+//
+// Created by inory on 12/24/25.
+//
+
+/**
+ * 百万fiber规模测试：spawn N个fiber挂起在WaitQueue、Channel、Fiber::sleep、socketpair读上，
+ * 报告spawn耗时、每fiber内存（按栈、Fiber对象、队列节点、定时器节点、FdContext拆分）、
+ * 全部唤醒的延迟和回收耗时。
+ *   fiber_scale_bench [--max N] [--scenario waitqueue|channel|sleep|socket|all] [--stack-kb K]
+ * N从1000开始每次乘10直到--max（默认1000000）。
+ *
+ * 内存拆分的口径：
+ *   heap      除栈以外的堆内存 = mallinfo2的uordblks增量（mmap阈值固定为栈大小，栈都走mmap，不计入uordblks）
+ *   stack     栈实际占用的物理内存 = RSS增量 - heap（栈按需缺页，通常只有栈顶的一两页）
+ *   fiber     sizeof(Fiber) + shared_ptr控制块 + 上下文对象
+ *   timer     sleep场景：TimerNode（make_shared）
+ *   fdctx     socket场景：FdContext + 两个WaitQueue + fd_contexts_的哈希节点
+ *   queue     heap里剩下的部分：等待队列/parking lot节点、调度队列节点、闭包等
+ * 后三项是按类型大小估算的，queue是残差。socket场景需要2N个fd，超过RLIMIT_NOFILE时跳过
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <malloc.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+#include "channel.h"
+#include "context.h"
+#include "io_fiber.h"
+#include "io_manager.h"
+#include "scheduler.h"
+#include "sync.h"
+#include "timer.h"
+#include "wait_queue.h"
+
+using namespace fiber;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// shared_ptr(new T)的控制块、make_shared的控制块、unordered_map节点头的近似大小
+constexpr size_t kSharedControlBlock = 24;
+constexpr size_t kInplaceControlBlock = 16;
+constexpr size_t kHashNodeOverhead = 24;
+
+struct Options {
+    size_t max = 1'000'000;
+    std::string scenario = "all";
+    size_t stack_size = UContext::DEFAULT_STACK_SIZE;
+};
+
+struct MemorySnapshot {
+    size_t rss{0};
+    size_t heap{0};
+};
+
+MemorySnapshot memory() {
+    MemorySnapshot snapshot;
+    if (FILE *file = std::fopen("/proc/self/statm", "r")) {
+        unsigned long size = 0, resident = 0;
+        if (std::fscanf(file, "%lu %lu", &size, &resident) == 2) {
+            snapshot.rss = resident * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        }
+        std::fclose(file);
+    }
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = ::mallinfo2();
+    snapshot.heap = info.uordblks;
+#endif
+    return snapshot;
+}
+
+double elapsedMs(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+// 被唤醒的fiber记录自己恢复运行的时间，取最大值作为全部唤醒完成的时间
+void markWoken(std::atomic<int64_t> &last) {
+    const int64_t now = Clock::now().time_since_epoch().count();
+    int64_t seen = last.load(std::memory_order_relaxed);
+    while (seen < now && !last.compare_exchange_weak(seen, now, std::memory_order_relaxed)) {
+    }
+}
+
+struct Result {
+    double spawn_ms{0};
+    double wake_ms{0};
+    double teardown_ms{0};
+    MemorySnapshot before;
+    MemorySnapshot parked;
+    MemorySnapshot after;
+};
+
+/**
+ * 一个场景：park(i)在fiber里挂起直到被唤醒，wake()唤醒所有fiber并返回开始唤醒的时间，
+ * teardown()释放场景持有的资源
+ */
+struct Scenario {
+    const char *name;
+    size_t extra_per_fiber; // 场景特有的、按类型估算的每fiber内存（timer或fdctx）
+    std::function<bool(size_t n)> prepare;
+    std::function<void(size_t i)> park;
+    std::function<Clock::time_point()> wake;
+    std::function<void()> teardown;
+};
+
+Result run(Scenario &scenario, size_t n, size_t stack_size) {
+    Result result;
+    std::atomic<size_t> parked{0};
+    std::atomic<int64_t> last_woken{0};
+
+    block_on([&] {
+        ::malloc_trim(0);
+        result.before = memory();
+        WaitGroup done;
+        done.add(static_cast<int>(n));
+
+        const auto spawn_start = Clock::now();
+        for (size_t i = 0; i < n; ++i) {
+            Fiber::go(
+                    [&, i] {
+                        parked.fetch_add(1, std::memory_order_relaxed);
+                        scenario.park(i);
+                        markWoken(last_woken);
+                        done.done();
+                    },
+                    0, stack_size);
+        }
+        // 全部fiber都跑到挂起点才算spawn完成
+        while (parked.load(std::memory_order_relaxed) < n) {
+            Fiber::sleep(1);
+        }
+        result.spawn_ms = elapsedMs(spawn_start, Clock::now());
+        // 最后一批fiber计数之后还要走到真正的挂起点
+        Fiber::sleep(10);
+        result.parked = memory();
+
+        const auto wake_start = scenario.wake();
+        done.wait();
+        const auto woken = Clock::time_point(Clock::duration(last_woken.load(std::memory_order_relaxed)));
+        result.wake_ms = elapsedMs(wake_start, woken);
+
+        // 回收：最后一个fiber恢复运行之后，到所有fiber退出、场景资源释放为止
+        scenario.teardown();
+        result.teardown_ms = elapsedMs(woken, Clock::now());
+    });
+    ::malloc_trim(0);
+    result.after = memory();
+    return result;
+}
+
+void printHeader() {
+    std::printf("%-10s %9s %10s %9s | %9s %9s %9s %9s %9s %9s | %10s %11s %10s\n", "scenario", "fibers",
+                "spawn(ms)", "ns/fiber", "rss/fib", "stack", "heap", "fiber", "extra", "queue", "wake(ms)",
+                "teardown(ms)", "rss_after");
+}
+
+void printResult(const Scenario &scenario, size_t n, const Result &result) {
+    const double rss = static_cast<double>(result.parked.rss) - static_cast<double>(result.before.rss);
+    const double heap =
+            std::max(static_cast<double>(result.parked.heap) - static_cast<double>(result.before.heap), 0.0);
+    const double per = 1.0 / static_cast<double>(n);
+    const double fiber = static_cast<double>(sizeof(Fiber) + kSharedControlBlock + sizeof(AsmContext));
+    const double extra = static_cast<double>(scenario.extra_per_fiber);
+    const double queue = std::max(heap * per - fiber - extra, 0.0);
+
+    std::printf("%-10s %9zu %10.1f %9.0f | %8.0fB %8.0fB %8.0fB %8.0fB %8.0fB %8.0fB | %10.2f %11.2f %8.1fMB\n",
+                scenario.name, n, result.spawn_ms, result.spawn_ms * 1e6 * per, rss * per,
+                std::max(rss - heap, 0.0) * per, heap * per, fiber, extra, queue, result.wake_ms, result.teardown_ms,
+                static_cast<double>(result.after.rss) / (1 << 20));
+    std::fflush(stdout);
+}
+
+size_t raiseFdLimit() {
+    rlimit limit{};
+    if (::getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return 1024;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    ::setrlimit(RLIMIT_NOFILE, &limit);
+    ::getrlimit(RLIMIT_NOFILE, &limit);
+    return limit.rlim_cur;
+}
+
+Options parseArgs(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        if (flag == "--max") {
+            options.max = std::strtoull(argv[i + 1], nullptr, 10);
+        } else if (flag == "--scenario") {
+            options.scenario = argv[i + 1];
+        } else if (flag == "--stack-kb") {
+            options.stack_size = std::strtoull(argv[i + 1], nullptr, 10) * 1024;
+        } else {
+            std::fprintf(stderr, "unknown flag %s\n", argv[i]);
+            std::exit(1);
+        }
+    }
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    const Options options = parseArgs(argc, argv);
+    const size_t fd_limit = raiseFdLimit();
+    // 固定mmap阈值（同时关闭glibc的动态调整）：栈全部单独mmap，小对象留在arena里，两者可以分开统计
+    ::mallopt(M_MMAP_THRESHOLD, static_cast<int>(options.stack_size));
+    ::mallopt(M_MMAP_MAX, std::numeric_limits<int>::max());
+
+    // WaitQueue：全部挂在同一个队列上，notify_all唤醒
+    WaitQueue wait_queue;
+    std::atomic<bool> released{false};
+
+    // Channel：全部阻塞在同一个channel的recv上，close唤醒
+    Channel<int>::ptr channel;
+
+    // Fiber::sleep：全部睡到同一个截止时间，唤醒延迟从截止时间开始算
+    Clock::time_point wake_deadline;
+
+    // socketpair：每个fiber阻塞读自己的一端，驱动fiber逐个写另一端
+    std::vector<int> socket_fds;
+
+    std::vector<Scenario> scenarios;
+    scenarios.push_back({"waitqueue", 0,
+                         [&](size_t) {
+                             released = false;
+                             return true;
+                         },
+                         [&](size_t) { wait_queue.wait_unless([&] { return released.load(); }); },
+                         [&] {
+                             const auto start = Clock::now();
+                             released = true;
+                             wait_queue.notify_all();
+                             return start;
+                         },
+                         [] {}});
+    scenarios.push_back({"channel", 0,
+                         [&](size_t) {
+                             channel = make_channel<int>(1);
+                             return true;
+                         },
+                         [&](size_t) {
+                             int value;
+                             channel->recv(value);
+                         },
+                         [&] {
+                             const auto start = Clock::now();
+                             channel->close();
+                             return start;
+                         },
+                         [&] { channel.reset(); }});
+    scenarios.push_back({"sleep", sizeof(TimerNode) + kInplaceControlBlock,
+                         [&](size_t n) {
+                             // 留出足够的spawn时间，所有fiber都在截止时间之前挂起
+                             wake_deadline = Clock::now() + std::chrono::milliseconds(1000 + n / 200);
+                             return true;
+                         },
+                         [&](size_t) {
+                             auto remaining = std::chrono::ceil<std::chrono::milliseconds>(wake_deadline - Clock::now());
+                             Fiber::sleep(static_cast<uint64_t>(std::max<int64_t>(remaining.count(), 1)));
+                         },
+                         [&] {
+                             // 等到截止时间，唤醒延迟只统计定时器到期之后的部分
+                             auto remaining = std::chrono::ceil<std::chrono::milliseconds>(wake_deadline - Clock::now());
+                             if (remaining.count() > 0) {
+                                 Fiber::sleep(static_cast<uint64_t>(remaining.count()));
+                             }
+                             return wake_deadline;
+                         },
+                         [] {}});
+    scenarios.push_back({"socket",
+                         sizeof(IOManager::FdContext) + 2 * sizeof(WaitQueue) + kInplaceControlBlock +
+                                 kHashNodeOverhead,
+                         [&](size_t n) {
+                             if (2 * n + 64 > fd_limit) {
+                                 std::printf("%-10s %9zu skipped: needs %zu fds, RLIMIT_NOFILE is %zu\n", "socket", n,
+                                             2 * n + 64, fd_limit);
+                                 return false;
+                             }
+                             socket_fds.assign(2 * n, -1);
+                             for (size_t i = 0; i < n; ++i) {
+                                 int pair[2];
+                                 if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+                                     std::printf("socketpair failed at %zu: %s\n", i, std::strerror(errno));
+                                     for (int fd: socket_fds) {
+                                         if (fd >= 0) {
+                                             ::close(fd);
+                                         }
+                                     }
+                                     return false;
+                                 }
+                                 socket_fds[2 * i] = pair[0];
+                                 socket_fds[2 * i + 1] = pair[1];
+                             }
+                             return true;
+                         },
+                         [&](size_t i) {
+                             char byte;
+                             IO::read(socket_fds[2 * i], &byte, 1);
+                         },
+                         [&] {
+                             const auto start = Clock::now();
+                             const char byte = 1;
+                             for (size_t i = 1; i < socket_fds.size(); i += 2) {
+                                 IO::write(socket_fds[i], &byte, 1);
+                             }
+                             return start;
+                         },
+                         [&] {
+                             for (int fd: socket_fds) {
+                                 IO::close(fd);
+                             }
+                             socket_fds.clear();
+                         }});
+
+    std::printf("sizeof: Fiber=%zu AsmContext=%zu TimerNode=%zu FdContext=%zu WaitQueue=%zu, stack=%zuKB\n",
+                sizeof(Fiber), sizeof(AsmContext), sizeof(TimerNode), sizeof(IOManager::FdContext), sizeof(WaitQueue),
+                options.stack_size / 1024);
+    printHeader();
+    for (auto &scenario: scenarios) {
+        if (options.scenario != "all" && options.scenario != scenario.name) {
+            continue;
+        }
+        for (size_t n = 1000; n <= options.max; n *= 10) {
+            if (!scenario.prepare(n)) {
+                continue;
+            }
+            printResult(scenario, n, run(scenario, n, options.stack_size));
+        }
+    }
+
+    Scheduler::getInst().stop();
+    return 0;
+}
@@ -0,0 +1,521 @@
+#include "buffer_ring.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <utility>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "fiber_consumer.h"
+#include "io_manager.h"
+#include "local_atomic.h"
+#include "parking_lot.h"
+#include "serika/basic/logger.h"
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+// provided buffer ring和IORING_RECVSEND_POLL_FIRST同在5.19引入，用它判断头文件是否足够新
+#if defined(IORING_RECVSEND_POLL_FIRST) && defined(__NR_io_uring_setup)
+#define FIBER_HAS_PBUF_RING 1
+#endif
+
+namespace fiber {
+
+// ==================== IOBuffer ====================
+
+IOBuffer::IOBuffer(IOBuffer &&other) noexcept :
+    owner_(std::exchange(other.owner_, nullptr)), data_(std::exchange(other.data_, nullptr)),
+    size_(std::exchange(other.size_, 0)), bid_(std::exchange(other.bid_, -1)) {}
+
+IOBuffer &IOBuffer::operator=(IOBuffer &&other) noexcept {
+    if (this != &other) {
+        reset();
+        owner_ = std::exchange(other.owner_, nullptr);
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        bid_ = std::exchange(other.bid_, -1);
+    }
+    return *this;
+}
+
+void IOBuffer::reset() {
+    if (owner_ && data_) {
+        owner_->release(data_, bid_);
+    }
+    owner_ = nullptr;
+    data_ = nullptr;
+    size_ = 0;
+    bid_ = -1;
+}
+
+// ==================== io_uring ====================
+
+struct BufferRing::Request {
+    LocalAtomic<uint32_t> done{0};
+    int32_t result{0};
+    uint32_t flags{0};
+};
+
+#ifdef FIBER_HAS_PBUF_RING
+
+static constexpr unsigned kQueueDepth = 128; // 读请求提交后立即进入内核，SQ不需要很深
+static constexpr unsigned kCompletionDepth = 4096;
+static constexpr uint16_t kBufferGroup = 0;
+
+/**
+ * 不依赖liburing，直接用系统调用和mmap操作SQ/CQ。只在所属consumer线程上提交和收割，没有开SQPOLL，
+ * 内核只在io_uring_enter里读取SQ，提交失败时可以直接回退tail
+ */
+struct BufferRing::Uring {
+    int ring_fd{-1};
+    int event_fd{-1};
+
+    void *sq_ptr{MAP_FAILED};
+    size_t sq_size{0};
+    void *cq_ptr{MAP_FAILED};
+    size_t cq_size{0};
+    io_uring_sqe *sqes{static_cast<io_uring_sqe *>(MAP_FAILED)};
+    size_t sqes_size{0};
+
+    unsigned sq_entries{0};
+    unsigned cq_entries{0};
+    unsigned *sq_flags{nullptr};
+    unsigned *sq_head{nullptr};
+    unsigned *sq_tail{nullptr};
+    unsigned *sq_mask{nullptr};
+    unsigned *sq_array{nullptr};
+    unsigned *cq_head{nullptr};
+    unsigned *cq_tail{nullptr};
+    unsigned *cq_mask{nullptr};
+    io_uring_cqe *cqes{nullptr};
+
+    io_uring_buf_ring *buf_ring{static_cast<io_uring_buf_ring *>(MAP_FAILED)};
+    size_t buf_ring_size{0};
+    char *buffers{static_cast<char *>(MAP_FAILED)};
+    size_t buffers_size{0};
+    unsigned buf_mask{0};
+    size_t buffer_size{0};
+
+    ~Uring() {
+        // 先关闭ring，内核取消所有未完成的请求之后再释放缓冲区
+        if (ring_fd >= 0) {
+            ::close(ring_fd);
+        }
+        if (event_fd >= 0) {
+            ::close(event_fd);
+        }
+        if (sqes != MAP_FAILED) {
+            ::munmap(sqes, sqes_size);
+        }
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) {
+            ::munmap(cq_ptr, cq_size);
+        }
+        if (sq_ptr != MAP_FAILED) {
+            ::munmap(sq_ptr, sq_size);
+        }
+        if (buf_ring != MAP_FAILED) {
+            ::munmap(buf_ring, buf_ring_size);
+        }
+        if (buffers != MAP_FAILED) {
+            ::munmap(buffers, buffers_size);
+        }
+    }
+
+    static std::unique_ptr<Uring> create(unsigned entries, size_t buffer_size) {
+        auto ring = std::make_unique<Uring>();
+
+        io_uring_params params{};
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = kCompletionDepth;
+        ring->ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, kQueueDepth, &params));
+        if (ring->ring_fd < 0) {
+            LOG_WARN("io_uring_setup failed: {}, read_any falls back to epoll", strerror(errno));
+            return nullptr;
+        }
+
+        ring->sq_entries = params.sq_entries;
+        ring->cq_entries = params.cq_entries;
+        ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            ring->sq_size = ring->cq_size = std::max(ring->sq_size, ring->cq_size);
+        }
+
+        ring->sq_ptr = ::mmap(nullptr, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+                              IORING_OFF_SQ_RING);
+        if (ring->sq_ptr == MAP_FAILED) {
+            LOG_WARN("mmap io_uring SQ failed: {}", strerror(errno));
+            return nullptr;
+        }
+        ring->cq_ptr = single_mmap ? ring->sq_ptr
+                                   : ::mmap(nullptr, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                            ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            LOG_WARN("mmap io_uring CQ failed: {}", strerror(errno));
+            return nullptr;
+        }
+        ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        ring->sqes = static_cast<io_uring_sqe *>(::mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                                        MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES));
+        if (ring->sqes == MAP_FAILED) {
+            LOG_WARN("mmap io_uring SQEs failed: {}", strerror(errno));
+            return nullptr;
+        }
+
+        auto *sq = static_cast<char *>(ring->sq_ptr);
+        auto *cq = static_cast<char *>(ring->cq_ptr);
+        ring->sq_flags = reinterpret_cast<unsigned *>(sq + params.sq_off.flags);
+        ring->sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        ring->sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        ring->sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        ring->sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        ring->cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        ring->cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        ring->cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        ring->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+        // 完成事件通过eventfd通知consumer的epoll
+        ring->event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (ring->event_fd < 0 ||
+            ::syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_EVENTFD, &ring->event_fd, 1) < 0) {
+            LOG_WARN("io_uring eventfd registration failed: {}", strerror(errno));
+            return nullptr;
+        }
+
+        // provided buffer ring：环本身和缓冲区都是匿名映射，缓冲区的物理页在内核第一次写入时才分配
+        long page_size = ::sysconf(_SC_PAGESIZE);
+        ring->buf_ring_size = (entries * sizeof(io_uring_buf) + page_size - 1) / page_size * page_size;
+        ring->buf_ring = static_cast<io_uring_buf_ring *>(
+                ::mmap(nullptr, ring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (ring->buf_ring == MAP_FAILED) {
+            LOG_WARN("mmap buffer ring failed: {}", strerror(errno));
+            return nullptr;
+        }
+
+        io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(ring->buf_ring);
+        reg.ring_entries = entries;
+        reg.bgid = kBufferGroup;
+        if (::syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            LOG_WARN("IORING_REGISTER_PBUF_RING failed: {}, read_any falls back to epoll", strerror(errno));
+            return nullptr;
+        }
+
+        ring->buffer_size = buffer_size;
+        ring->buffers_size = entries * buffer_size;
+        ring->buffers = static_cast<char *>(::mmap(nullptr, ring->buffers_size, PROT_READ | PROT_WRITE,
+                                                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+        if (ring->buffers == MAP_FAILED) {
+            LOG_WARN("mmap ring buffers failed: {}", strerror(errno));
+            return nullptr;
+        }
+
+        ring->buf_mask = entries - 1;
+        for (unsigned bid = 0; bid < entries; ++bid) {
+            ring->provide(static_cast<uint16_t>(bid));
+        }
+        return ring;
+    }
+
+    char *bufferData(uint16_t bid) const { return buffers + static_cast<size_t>(bid) * buffer_size; }
+
+    // 把缓冲区放回provided buffer ring，只有本consumer写tail
+    void provide(uint16_t bid) {
+        uint16_t tail = buf_ring->tail;
+        io_uring_buf &buf = buf_ring->bufs[tail & buf_mask];
+        buf.addr = reinterpret_cast<uint64_t>(bufferData(bid));
+        buf.len = static_cast<uint32_t>(buffer_size);
+        buf.bid = bid;
+        std::atomic_ref<uint16_t>(buf_ring->tail).store(static_cast<uint16_t>(tail + 1), std::memory_order_release);
+    }
+
+    // 每个读请求最终产生一个CQE，超时取消还会再多一个，在途请求不超过CQ的一半就不会溢出
+    size_t maxInflight() const { return cq_entries / 2; }
+
+    // CQ满时内核（IORING_FEAT_NODROP）把完成事件暂存在溢出链表里并置位IORING_SQ_CQ_OVERFLOW，
+    // 需要带IORING_ENTER_GETEVENTS进入一次内核才会搬回CQ
+    bool flushOverflow() {
+        if (!(std::atomic_ref<unsigned>(*sq_flags).load(std::memory_order_acquire) & IORING_SQ_CQ_OVERFLOW)) {
+            return false;
+        }
+        int ret;
+        do {
+            ret = static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, 0, 0, IORING_ENTER_GETEVENTS, nullptr, 0));
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0) {
+            LOG_ERROR("io_uring_enter flushing CQ overflow failed: {}", strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    bool submit(const io_uring_sqe &sqe) {
+        unsigned tail = *sq_tail;
+        unsigned head = std::atomic_ref<unsigned>(*sq_head).load(std::memory_order_acquire);
+        if (tail - head >= sq_entries) {
+            errno = EBUSY;
+            return false;
+        }
+
+        unsigned index = tail & *sq_mask;
+        sqes[index] = sqe;
+        sq_array[index] = index;
+        std::atomic_ref<unsigned>(*sq_tail).store(tail + 1, std::memory_order_release);
+
+        int ret;
+        do {
+            ret = static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, nullptr, 0));
+        } while (ret < 0 && errno == EINTR);
+
+        if (ret <= 0) {
+            // 内核没有取走这个SQE，回退tail，避免以后被当成无人等待的请求提交
+            std::atomic_ref<unsigned>(*sq_tail).store(tail, std::memory_order_release);
+            if (ret == 0) {
+                errno = EAGAIN;
+            }
+            return false;
+        }
+        return true;
+    }
+};
+
+#else
+
+struct BufferRing::Uring {
+    static std::unique_ptr<Uring> create(unsigned, size_t) {
+        LOG_WARN("built without io_uring provided buffer ring support, read_any falls back to epoll");
+        return nullptr;
+    }
+};
+
+#endif // FIBER_HAS_PBUF_RING
+
+// ==================== BufferRing ====================
+
+BufferRing::BufferRing(FiberConsumer *consumer, IOManager &io_manager, unsigned entries, size_t buffer_size,
+                       bool use_uring) :
+    consumer_(consumer), io_manager_(io_manager),
+    entries_(std::bit_ceil(std::clamp(entries, 1u, 32768u))), // buffer id是16位，环大小必须是2的幂
+    buffer_size_(buffer_size) {
+    if (!use_uring) {
+        return;
+    }
+
+    uring_ = Uring::create(entries_, buffer_size_);
+#ifdef FIBER_HAS_PBUF_RING
+    if (uring_ && !io_manager_.addWatch(uring_->event_fd, EPOLLIN, [this]() {
+            uint64_t count;
+            while (::read(uring_->event_fd, &count, sizeof(count)) == sizeof(count)) {
+            }
+            reap();
+        })) {
+        uring_.reset();
+    }
+#endif
+}
+
+BufferRing::~BufferRing() {
+#ifdef FIBER_HAS_PBUF_RING
+    if (uring_) {
+        io_manager_.removeWatch(uring_->event_fd);
+    }
+#endif
+    // 已经没有consumer线程了，直接回收其他线程归还的缓冲区
+    while (auto released = released_.pop_front_lockfree()) {
+        if (released->bid < 0) {
+            delete[] released->data;
+        }
+    }
+}
+
+std::optional<IOBuffer> BufferRing::read(int fd, int64_t timeout_ms) {
+#ifdef FIBER_HAS_PBUF_RING
+    if (!uring_) {
+        errno = ENOSYS;
+        return std::nullopt;
+    }
+    drainReleased();
+
+    // 在途请求过多时CQ可能溢出，这时和环里没有缓冲区一样退回epoll路径
+    if (inflight_.size() >= uring_->maxInflight()) {
+        errno = ENOBUFS;
+        return std::nullopt;
+    }
+
+    uint64_t user_data = next_user_data_++;
+    io_uring_sqe sqe{};
+    sqe.opcode = IORING_OP_READ;
+    sqe.fd = fd;
+    sqe.off = static_cast<uint64_t>(-1); // 使用文件当前位置，socket和pipe忽略
+    sqe.len = static_cast<uint32_t>(buffer_size_);
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.buf_group = kBufferGroup;
+    sqe.user_data = user_data;
+    if (!uring_->submit(sqe)) {
+        LOG_ERROR("io_uring submit read failed: fd={}, error={}", fd, strerror(errno));
+        return std::nullopt;
+    }
+
+    auto request = std::make_shared<Request>();
+    inflight_.emplace(user_data, request);
+
+    // 完成前内核一直持有这个请求：超时或者抛出异常时都要先取消，完成事件到达后再回收缓冲区
+    bool timed_out = false;
+    try {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max<int64_t>(timeout_ms, 0));
+        while (request->done.load(std::memory_order_acquire) == 0) {
+            int64_t wait_ms = -1;
+            if (timeout_ms >= 0) {
+                wait_ms = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now())
+                                  .count();
+                if (wait_ms <= 0) {
+                    break;
+                }
+            }
+            wait_on(request->done, 0u, wait_ms);
+        }
+
+        if (request->done.load(std::memory_order_acquire) == 0) {
+            timed_out = true;
+            cancel(user_data);
+            while (request->done.load(std::memory_order_acquire) == 0) {
+                wait_on(request->done, 0u);
+            }
+        }
+    } catch (...) {
+        if (request->done.load(std::memory_order_acquire) == 0) {
+            cancel(user_data);
+        }
+        throw;
+    }
+
+    if (request->flags & IORING_CQE_F_BUFFER) {
+        auto bid = static_cast<uint16_t>(request->flags >> IORING_CQE_BUFFER_SHIFT);
+        if (request->result > 0) {
+            return IOBuffer(this, uring_->bufferData(bid), static_cast<size_t>(request->result), bid);
+        }
+        uring_->provide(bid);
+    }
+
+    if (request->result == 0) {
+        return IOBuffer(); // EOF
+    }
+    errno = (timed_out && request->result == -ECANCELED) ? ETIMEDOUT : -request->result;
+    return std::nullopt;
+#else
+    (void) fd;
+    (void) timeout_ms;
+    errno = ENOSYS;
+    return std::nullopt;
+#endif
+}
+
+void BufferRing::cancel(uint64_t user_data) {
+#ifdef FIBER_HAS_PBUF_RING
+    io_uring_sqe sqe{};
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.fd = -1;
+    sqe.addr = user_data;
+    sqe.user_data = 0;
+    if (!uring_->submit(sqe)) {
+        LOG_ERROR("io_uring submit cancel failed: {}", strerror(errno));
+    }
+#else
+    (void) user_data;
+#endif
+}
+
+void BufferRing::reap() {
+#ifdef FIBER_HAS_PBUF_RING
+    drainReleased();
+
+    do {
+        reapCompletions();
+        // 溢出的完成事件搬回CQ时不一定会再写eventfd，搬完接着收割
+    } while (uring_->flushOverflow());
+#endif
+}
+
+void BufferRing::reapCompletions() {
+#ifdef FIBER_HAS_PBUF_RING
+    unsigned head = *uring_->cq_head;
+    unsigned tail = std::atomic_ref<unsigned>(*uring_->cq_tail).load(std::memory_order_acquire);
+    for (; head != tail; ++head) {
+        const io_uring_cqe &cqe = uring_->cqes[head & *uring_->cq_mask];
+
+        std::shared_ptr<Request> request;
+        if (auto it = inflight_.find(cqe.user_data); it != inflight_.end()) {
+            request = std::move(it->second);
+            inflight_.erase(it);
+        }
+
+        // 取消请求的完成事件，或者等待的fiber已经因为异常退出，直接回收内核选中的缓冲区
+        if (!request || request.use_count() == 1) {
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                uring_->provide(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+            continue;
+        }
+
+        request->result = cqe.res;
+        request->flags = cqe.flags;
+        request->done.store(1, std::memory_order_release);
+        notify_one(&request->done);
+    }
+    std::atomic_ref<unsigned>(*uring_->cq_head).store(head, std::memory_order_release);
+#endif
+}
+
+IOBuffer BufferRing::acquire() {
+    drainReleased();
+
+    std::unique_ptr<char[]> buffer;
+    if (!pool_.empty()) {
+        buffer = std::move(pool_.back());
+        pool_.pop_back();
+    } else {
+        buffer.reset(new char[buffer_size_]);
+    }
+    return IOBuffer(this, buffer.release(), buffer_size_, -1);
+}
+
+void BufferRing::release(char *data, int32_t bid) {
+    if (FiberConsumer::current() == consumer_) {
+        recycle(data, bid);
+    } else {
+        released_.push_back_lockfree(Released{data, bid});
+    }
+}
+
+void BufferRing::recycle(char *data, int32_t bid) {
+    if (bid >= 0) {
+#ifdef FIBER_HAS_PBUF_RING
+        uring_->provide(static_cast<uint16_t>(bid));
+#endif
+        return;
+    }
+
+    std::unique_ptr<char[]> buffer(data);
+    if (pool_.size() < entries_) {
+        pool_.push_back(std::move(buffer));
+    }
+}
+
+void BufferRing::drainReleased() {
+    while (!released_.empty()) {
+        auto released = released_.pop_front_lockfree();
+        if (!released) {
+            break;
+        }
+        recycle(released->data, released->bid);
+    }
+}
+
+} // namespace fiber
@@ -0,0 +1,164 @@
+#include "contention.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "sync.h"
+
+namespace fiber::contention {
+
+namespace detail {
+std::atomic<uint32_t> rate{0};
+} // namespace detail
+
+namespace {
+
+constexpr size_t kShardCount = 16;
+
+struct Key {
+    const void *lock;
+    uintptr_t site;
+
+    bool operator==(const Key &other) const { return lock == other.lock && site == other.site; }
+};
+
+struct KeyHash {
+    size_t operator()(const Key &key) const {
+        return std::hash<const void *>()(key.lock) * 31 + std::hash<uintptr_t>()(key.site);
+    }
+};
+
+// 按键的哈希分片，不同锁的记录基本不会争抢同一个分片
+struct alignas(CACHE_LINE_SIZE) Shard {
+    SpinLock lock;
+    std::unordered_map<Key, Record, KeyHash> records;
+};
+
+Shard g_shards[kShardCount];
+std::mutex g_mutex; // 保护start/stop
+uint32_t g_last_rate{1};
+
+Record &find(Shard &shard, const void *lock, uintptr_t site) {
+    auto &record = shard.records[Key{lock, site}];
+    record.lock = lock;
+    record.site = site;
+    return record;
+}
+
+Shard &shardOf(const void *lock, uintptr_t site) { return g_shards[KeyHash()(Key{lock, site}) % kShardCount]; }
+
+std::string symbolize(uintptr_t site) {
+    // 返回地址指向call的下一条指令，减1才落在调用者内部
+    const uintptr_t lookup = site - 1;
+    Dl_info info{};
+    char buffer[64];
+    if (::dladdr(reinterpret_cast<void *>(lookup), &info) && info.dli_sname) {
+        int status = 0;
+        char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        std::string name = status == 0 && demangled ? demangled : info.dli_sname;
+        std::free(demangled);
+        std::snprintf(buffer, sizeof(buffer), "+0x%zx", lookup - reinterpret_cast<uintptr_t>(info.dli_saddr));
+        return name + buffer;
+    }
+    if (info.dli_fname) {
+        const char *module = std::strrchr(info.dli_fname, '/');
+        std::snprintf(buffer, sizeof(buffer), "+0x%zx", lookup - reinterpret_cast<uintptr_t>(info.dli_fbase));
+        return std::string(module ? module + 1 : info.dli_fname) + buffer;
+    }
+    std::snprintf(buffer, sizeof(buffer), "0x%zx", lookup);
+    return buffer;
+}
+
+} // namespace
+
+bool start(uint32_t rate) {
+    std::lock_guard<std::mutex> guard(g_mutex);
+    if (detail::rate.load(std::memory_order_relaxed) != 0) {
+        return false;
+    }
+    g_last_rate = std::max<uint32_t>(rate, 1);
+    detail::rate.store(g_last_rate, std::memory_order_relaxed);
+    LOG_INFO("[contention] started, sampling 1/{}", g_last_rate);
+    return true;
+}
+
+void stop() {
+    std::lock_guard<std::mutex> guard(g_mutex);
+    detail::rate.store(0, std::memory_order_relaxed);
+}
+
+bool running() { return detail::rate.load(std::memory_order_relaxed) != 0; }
+
+void reset() {
+    for (auto &shard: g_shards) {
+        std::lock_guard guard(shard.lock);
+        shard.records.clear();
+    }
+}
+
+std::vector<Record> snapshot() {
+    std::vector<Record> result;
+    for (auto &shard: g_shards) {
+        std::lock_guard guard(shard.lock);
+        for (auto &[key, record]: shard.records) {
+            result.push_back(record);
+        }
+    }
+    std::sort(result.begin(), result.end(), [](const Record &a, const Record &b) { return a.wait > b.wait; });
+    return result;
+}
+
+void write_report(std::ostream &out, size_t max_entries) {
+    auto records = snapshot();
+    if (max_entries != 0 && records.size() > max_entries) {
+        records.resize(max_entries);
+    }
+
+    uint32_t rate;
+    {
+        std::lock_guard<std::mutex> guard(g_mutex);
+        rate = g_last_rate;
+    }
+    out << "--- contention (sampling 1/" << rate << ", counts and times scaled) ---\n";
+    char line[128];
+    std::snprintf(line, sizeof(line), "%12s %12s %12s %12s  %-18s %s\n", "contentions", "wait(ms)", "avg wait(us)",
+                  "hold(ms)", "lock", "site");
+    out << line;
+    for (const auto &record: records) {
+        const double wait_ms = static_cast<double>(record.wait.count()) / 1e6;
+        const double avg_us = record.contentions
+                                      ? static_cast<double>(record.wait.count()) / 1e3 /
+                                                static_cast<double>(record.contentions)
+                                      : 0.0;
+        const double hold_ms = static_cast<double>(record.hold.count()) / 1e6;
+        std::snprintf(line, sizeof(line), "%12lu %12.3f %12.3f %12.3f  %-18p ", static_cast<unsigned long>(record.contentions),
+                      wait_ms, avg_us, hold_ms, record.lock);
+        out << line << symbolize(record.site) << '\n';
+    }
+}
+
+void record_wait(const void *lock, const void *site, std::chrono::nanoseconds wait) {
+    const uint32_t rate = std::max<uint32_t>(detail::rate.load(std::memory_order_relaxed), 1);
+    const auto pc = reinterpret_cast<uintptr_t>(site);
+    auto &shard = shardOf(lock, pc);
+    std::lock_guard guard(shard.lock);
+    auto &record = find(shard, lock, pc);
+    record.contentions += rate;
+    record.wait += wait * rate;
+}
+
+void record_hold(const void *lock, const void *site, std::chrono::nanoseconds hold) {
+    const uint32_t rate = std::max<uint32_t>(detail::rate.load(std::memory_order_relaxed), 1);
+    const auto pc = reinterpret_cast<uintptr_t>(site);
+    auto &shard = shardOf(lock, pc);
+    std::lock_guard guard(shard.lock);
+    find(shard, lock, pc).hold += hold * rate;
+}
+
+} // namespace fiber::contention
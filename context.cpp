@@ -1,14 +1,188 @@
 #include "context.h"
+#include <algorithm>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
+#include <mutex>
 #include <stdexcept>
 #include <sys/mman.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
 
 #include "fiber.h"
 #include "serika/basic/logger.h"
 
 namespace fiber {
 
+// ============================== StackPool Begin ================================= //
+
+namespace {
+
+constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+// 由Scheduler在创建第一个栈之前配置
+StackOptions stack_options;
+std::atomic<bool> stack_allocated{false};
+
+// 大页区域切出来的栈不单独归还给系统，线程缓存放不下时回到这里
+std::mutex huge_stack_mutex;
+std::unordered_map<size_t, std::vector<void *>> huge_free_stacks;
+
+size_t page_size() {
+    static const size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+size_t round_up(size_t n, size_t align) { return (n + align - 1) / align * align; }
+
+void touch_pages(void *begin, size_t len) {
+    volatile char *p = static_cast<char *>(begin);
+    for (size_t off = 0; off < len; off += page_size()) {
+        p[off] = 0;
+    }
+}
+
+/**
+ * @brief 映射一块2MB对齐的大页区域并切分成栈
+ * 优先MAP_HUGETLB，没有预留hugetlbfs页时退化为透明大页（MADV_HUGEPAGE）
+ */
+void carve_huge_region(size_t size, std::vector<void *> &out) {
+    const size_t stack_bytes = round_up(size, page_size());
+    const size_t region = round_up(std::max(stack_bytes, kHugePageSize), kHugePageSize);
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK;
+
+    void *base = mmap(nullptr, region, PROT_READ | PROT_WRITE,
+                      flags | MAP_HUGETLB | (stack_options.populate ? MAP_POPULATE : 0), -1, 0);
+    if (base == MAP_FAILED) {
+        void *raw = mmap(nullptr, region + kHugePageSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (raw == MAP_FAILED) {
+            throw std::runtime_error("mmap huge page stack region failed");
+        }
+
+        // 裁掉首尾，保证区域按2MB对齐
+        const uintptr_t raw_addr = reinterpret_cast<uintptr_t>(raw);
+        const uintptr_t aligned = round_up(raw_addr, kHugePageSize);
+        const size_t head = aligned - raw_addr;
+        if (head > 0) {
+            munmap(raw, head);
+        }
+        if (kHugePageSize - head > 0) {
+            munmap(reinterpret_cast<char *>(aligned) + region, kHugePageSize - head);
+        }
+
+        base = reinterpret_cast<void *>(aligned);
+        if (madvise(base, region, MADV_HUGEPAGE) != 0) {
+            LOG_WARN("[StackPool] madvise(MADV_HUGEPAGE) failed: {}", strerror(errno));
+        }
+        if (stack_options.populate) {
+            // madvise之后再触碰，才能拿到大页
+            touch_pages(base, region);
+        }
+    }
+
+    for (size_t off = 0; off + stack_bytes <= region; off += stack_bytes) {
+        out.push_back(static_cast<char *>(base) + off);
+    }
+}
+
+void *allocate_stack(size_t size) {
+    if (stack_options.huge_pages) {
+        std::lock_guard<std::mutex> lock(huge_stack_mutex);
+        auto &free_stacks = huge_free_stacks[size];
+        if (free_stacks.empty()) {
+            carve_huge_region(size, free_stacks);
+        }
+        void *stack = free_stacks.back();
+        free_stacks.pop_back();
+        return stack;
+    }
+
+    if (stack_options.populate) {
+        void *stack = mmap(nullptr, round_up(size, page_size()), PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_POPULATE, -1, 0);
+        if (stack == MAP_FAILED) {
+            throw std::runtime_error("Failed to allocate stack");
+        }
+        return stack;
+    }
+
+    void *stack = std::malloc(size);
+    if (!stack) {
+        throw std::runtime_error("Failed to allocate stack");
+    }
+    return stack;
+}
+
+void free_stack(void *stack, size_t size) {
+    if (stack_options.huge_pages) {
+        std::lock_guard<std::mutex> lock(huge_stack_mutex);
+        huge_free_stacks[size].push_back(stack);
+        return;
+    }
+
+    if (stack_options.populate) {
+        munmap(stack, round_up(size, page_size()));
+        return;
+    }
+
+    std::free(stack);
+}
+
+struct StackCache {
+    std::vector<void *> stacks;
+
+    ~StackCache() {
+        for (void *stack: stacks) {
+            free_stack(stack, StackfulContext::DEFAULT_STACK_SIZE);
+        }
+    }
+};
+
+thread_local StackCache stack_cache;
+
+} // namespace
+
+void StackPool::configure(const StackOptions &options) {
+    if (stack_allocated.load(std::memory_order_acquire)) {
+        LOG_WARN("[StackPool] stacks already allocated, stack options ignored");
+        return;
+    }
+    stack_options = options;
+}
+
+const StackOptions &StackPool::options() { return stack_options; }
+
+void *StackPool::acquire(size_t size) {
+    stack_allocated.store(true, std::memory_order_release);
+
+    if (size == StackfulContext::DEFAULT_STACK_SIZE && !stack_cache.stacks.empty()) {
+        void *stack = stack_cache.stacks.back();
+        stack_cache.stacks.pop_back();
+        return stack;
+    }
+
+    void *stack = allocate_stack(size);
+
+    // 新栈预先触碰栈顶（栈向下增长），把首次缺页从请求路径上挪走
+    if (stack_options.prefault_bytes > 0) {
+        const size_t len = round_up(std::min(stack_options.prefault_bytes, size), page_size());
+        const size_t begin = size > len ? size - len : 0;
+        touch_pages(static_cast<char *>(stack) + begin, size - begin);
+    }
+    return stack;
+}
+
+void StackPool::release(void *stack, size_t size) {
+    if (size == StackfulContext::DEFAULT_STACK_SIZE && stack_cache.stacks.size() < kMaxCachedStacks) {
+        stack_cache.stacks.push_back(stack);
+        return;
+    }
+    free_stack(stack, size);
+}
+
+// ============================== StackPool End =================================== //
+
 // ============================== UContext Begin ================================== //
 
 UContext::UContext(size_t st_sz) : context_() {
@@ -193,17 +367,14 @@ AsmContext::AsmContext(size_t stack_size) {
 
 AsmContext::~AsmContext() {
     if (stack_) {
-        std::free(stack_);
+        StackPool::release(stack_, stack_size_);
         stack_ = nullptr;
     }
 }
 
 void AsmContext::initialize(void (*func)()) {
     if (!stack_) {
-        stack_ = std::malloc(stack_size_);
-        if (!stack_) {
-            throw std::runtime_error("Failed to allocate stack");
-        }
+        stack_ = StackPool::acquire(stack_size_);
         // 非必要的
         // memset(stack_, 0, stack_size_);
     }
@@ -2,8 +2,11 @@
 #include <cassert>
 #include <ucontext.h>
 
+#include "accounting.h"
 #include "context.h"
 #include "fiber.h"
+#include "hires_timer.h"
+#include "probes.h"
 #include "scheduler.h"
 #include "serika/basic/logger.h"
 #include "timer.h"
@@ -16,7 +19,18 @@ thread_local std::weak_ptr<Fiber> Fiber::current_fiber_weak_;
 
 std::atomic<uint64_t> fiber_id_counter{0};
 
-uint64_t Fiber::generateId() { return ++fiber_id_counter; }
+// 每个线程一次从全局计数器领取一段id，避免每次spawn都去争抢同一个原子变量
+static constexpr uint64_t kFiberIdBlockSize = 1024;
+static thread_local uint64_t fiber_id_next = 0;
+static thread_local uint64_t fiber_id_end = 0;
+
+uint64_t Fiber::generateId() {
+    if (fiber_id_next == fiber_id_end) {
+        fiber_id_next = fiber_id_counter.fetch_add(kFiberIdBlockSize, std::memory_order_relaxed) + 1;
+        fiber_id_end = fiber_id_next + kFiberIdBlockSize;
+    }
+    return fiber_id_next++;
+}
 
 
 Fiber::Fiber(FiberFunction func) :
@@ -32,10 +46,10 @@ void Fiber::Init(size_t stack_size) {
         return;
     }
 
-    // non-main fiber 需要先初始化一片上下文以供切换
-    context_ = AsmContext::createContext(stack_size);
-    // LOG_DEBUG("[Fiber::Init] Initializing fiber");
-    context_->initialize(&Fiber::fiberEntry);
+    // non-main fiber 的上下文和栈延迟到首次resume时再从栈池获取，
+    // 大量fiber排队时不会提前占用栈内存
+    stack_size_ = stack_size;
+    FIBER_PROBE2(create, id_, stack_size_);
 
     // LOG_DEBUG("Fiber created with ID: {}", id_);  // 过于频繁，注释掉
 }
@@ -51,7 +65,13 @@ void Fiber::resume() {
         LOG_WARN("Resuming a finished fiber");
         return;
     }
-    assert(context_ && "Fiber context is null");
+
+    if (!context_) {
+        // 首次resume，此时才取栈
+        context_ = AsmContext::createContext(stack_size_);
+        // LOG_DEBUG("[Fiber::resume] Initializing fiber");
+        context_->initialize(&Fiber::fiberEntry);
+    }
 
     auto current_fiber = Fiber::GetCurrentFiberPtr();
     if (!current_fiber) {
@@ -66,17 +86,33 @@ void Fiber::resume() {
 
     SetCurrentFiberPtr(shared_from_this());
     state_ = FiberState::RUNNING;
+    // 从切入到切回（yield、挂起或跑完）之间就是这个fiber在CPU上的时间
+    const bool account = accounting::enabled();
+    const uint64_t start = account ? accounting::now() : 0;
+    FIBER_PROBE2(resume, id_, trace_id_);
     current_fiber->context_->switchTo(context_.get());
+    if (account) {
+        const uint64_t cycles = accounting::now() - start;
+        cpu_cycles_ += cycles;
+        accounting::charge(*this, cycles);
+    }
+
+    // fiber已经跑完，已经切回到了父fiber的栈上，立即把栈还给栈池，不必等Fiber对象析构
+    if (state_ == FiberState::DONE) {
+        context_.reset();
+    }
 }
 
 void Fiber::yield() {
     Fiber *current = current_fiber_;
     assert(current && "No current fiber");
+    CheckDeadline();
 
     // 只有在不是DONE状态时才设置为SUSPENDED
     if (current->state_ != FiberState::DONE) {
         current->state_ = FiberState::SUSPENDED;
     }
+    FIBER_PROBE1(yield, current->id_);
 
     yield_internal(current);
 }
@@ -90,6 +126,7 @@ void Fiber::block_yield() {
     if (current->state_ != FiberState::DONE) {
         current->state_ = FiberState::BLOCKED;
     }
+    FIBER_PROBE1(block, current->id_);
 
     yield_internal(current);
 }
@@ -128,10 +165,15 @@ void Fiber::fiberEntry() {
     assert(current && "No current fiber in fiberEntry");
 
     if (current->func_) {
-        current->func_();
+        try {
+            current->func_();
+        } catch (const DeadlineExceeded &) {
+            // LOG_DEBUG("Fiber {} canceled: deadline exceeded", current->getId());
+        }
     }
 
     current->state_ = FiberState::DONE;
+    FIBER_PROBE1(done, current->id_);
 
     yield_internal(current);
 }
@@ -153,10 +195,69 @@ void Fiber::go(FiberFunction func, uint64_t feature_id, size_t stack_size) {
     auto fiber = Fiber::create(std::move(func), stack_size);
     fiber->setRunMode(RunMode::SCHEDULED);
     fiber->SetTraceId(fiber->getId() + feature_id);
+    fiber->inheritFrom(current_fiber_);
+    fiber->root_ = !InSchedulableFiber();
+
+    scheduler.scheduleImmediate(fiber);
+}
+
+bool Fiber::go_root(FiberFunction func, uint64_t feature_id, size_t stack_size) {
+    auto &&scheduler = Scheduler::getInst();
+
+    auto fiber = Fiber::create(std::move(func), stack_size);
+    fiber->setRunMode(RunMode::SCHEDULED);
+    fiber->SetTraceId(fiber->getId() + feature_id);
+    fiber->inheritFrom(current_fiber_);
+    fiber->root_ = true;
+
+    return scheduler.scheduleImmediate(fiber);
+}
+
+void Fiber::go_on(uint64_t consumer_id, FiberFunction func, size_t stack_size) {
+    auto &&scheduler = Scheduler::getInst();
+    assert(consumer_id < static_cast<uint64_t>(scheduler.getWorkerCount()) && "go_on: invalid consumer id");
+
+    auto fiber = Fiber::create(std::move(func), stack_size);
+    fiber->setRunMode(RunMode::SCHEDULED);
+    fiber->SetTraceId(fiber->getId());
+    fiber->inheritFrom(current_fiber_);
+    fiber->SetConsumerId(consumer_id);
+
+    scheduler.scheduleImmediate(fiber);
+}
+
+void Fiber::go_system(FiberFunction func, int64_t consumer_id, size_t stack_size) {
+    auto &&scheduler = Scheduler::getInst();
+    assert(consumer_id < static_cast<int64_t>(scheduler.getWorkerCount()) && "go_system: invalid consumer id");
+
+    // 不调用inheritFrom：常驻fiber不能因为拉起它的请求超时而退出；root_为false，准入控制不会拒绝
+    auto fiber = Fiber::create(std::move(func), stack_size);
+    fiber->setRunMode(RunMode::SCHEDULED);
+    fiber->SetTraceId(fiber->getId());
+    if (consumer_id >= 0) {
+        fiber->SetConsumerId(static_cast<uint64_t>(consumer_id));
+    }
 
     scheduler.scheduleImmediate(fiber);
 }
 
+void Fiber::go_batch(std::vector<FiberFunction> funcs, uint64_t feature_id, size_t stack_size) {
+    auto &&scheduler = Scheduler::getInst();
+
+    std::vector<Fiber::ptr> fibers;
+    fibers.reserve(funcs.size());
+    for (auto &func: funcs) {
+        auto fiber = Fiber::create(std::move(func), stack_size);
+        fiber->setRunMode(RunMode::SCHEDULED);
+        fiber->SetTraceId(fiber->getId() + feature_id);
+        fiber->inheritFrom(current_fiber_);
+        fiber->root_ = !InSchedulableFiber();
+        fibers.push_back(std::move(fiber));
+    }
+
+    scheduler.scheduleBatch(fibers);
+}
+
 Fiber::ptr Fiber::create(FiberFunction func, size_t stack_size) {
     auto fiber = std::shared_ptr<Fiber>(new Fiber(std::move(func)));
     fiber->Init(stack_size);
@@ -182,6 +283,7 @@ void Fiber::sleep(uint64_t ms) {
         std::this_thread::sleep_for(std::chrono::milliseconds(ms));
         return;
     }
+    CheckDeadline();
 
     auto &timer_wheel = Scheduler::getThreadLocalTimerManager();
     timer_wheel.addTimer(
@@ -197,6 +299,29 @@ void Fiber::sleep(uint64_t ms) {
     Fiber::block_yield();
 }
 
+void Fiber::sleep_us(uint64_t us) {
+    if (us == 0) {
+        return;
+    }
+
+    auto current = GetCurrentFiberPtr();
+    if (!current) {
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+        return;
+    }
+
+    auto *hires_timer = Scheduler::getThreadLocalHighResTimer();
+    if (!hires_timer) {
+        sleep((us + 999) / 1000);
+        return;
+    }
+    CheckDeadline();
+
+    hires_timer->addAfter(std::chrono::microseconds(us), [current]() { Scheduler::getInst().scheduleImmediate(current); });
+
+    Fiber::block_yield();
+}
+
 Fiber::ptr Fiber::GetCurrentFiberPtr() {
     return current_fiber_weak_.lock(); // 安全地转换为shared_ptr
 }
@@ -223,4 +348,40 @@ uint64_t Fiber::GetTraceId() const {
     return trace_id_;
 }
 
+void Fiber::SetDeadline(TimePoint deadline) { deadline_ = deadline; }
+
+void Fiber::ClearDeadline() { deadline_.reset(); }
+
+std::optional<Fiber::TimePoint> Fiber::GetDeadline() const { return deadline_; }
+
+bool Fiber::IsDeadlineExceeded() const { return deadline_ && Clock::now() >= *deadline_; }
+
+void Fiber::CheckDeadline() {
+    Fiber *current = current_fiber_;
+    if (current && current->IsDeadlineExceeded()) {
+        throw DeadlineExceeded();
+    }
+}
+
+bool Fiber::InSchedulableFiber() {
+    // consumer线程上的main fiber只是调度循环本身（定时器回调、IO回调都在这里执行）
+    return current_fiber_ != nullptr && current_fiber_ != main_fiber_.get();
+}
+
+void Fiber::inheritFrom(const Fiber *parent) {
+    if (!parent) {
+        return;
+    }
+    tag_ = parent->tag_;
+    if (parent->deadline_) {
+        deadline_ = parent->deadline_;
+    }
+}
+
+void Fiber::discard() {
+    assert(state_ == FiberState::READY && "only a fiber that never ran can be discarded");
+    state_ = FiberState::DONE;
+    func_ = nullptr;
+}
+
 } // namespace fiber
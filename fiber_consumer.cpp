@@ -1,22 +1,36 @@
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <thread>
 
 #include "fiber_consumer.h"
+#include "buffer_ring.h"
+#include "hires_timer.h"
 #include "timer.h"
 #include "io_manager.h"
+#include "probes.h"
+#include "profiler.h"
+#include "rcu.h"
 #include "scheduler.h"
 #include "serika/basic/logger.h"
 
 namespace fiber {
 
+thread_local FiberConsumer *FiberConsumer::current_ = nullptr;
+
 FiberConsumer::FiberConsumer(int id, Scheduler *scheduler) :
     id_(id), scheduler_(scheduler),
     // , queue_(std::make_unique<moodycamel::ConcurrentQueue<std::shared_ptr<Fiber>>>()) {
     queue_(std::make_unique<LockFreeLinkedList<std::shared_ptr<Fiber>>>()),
+    spawn_queue_(std::make_unique<StealDeque<std::shared_ptr<Fiber>>>()),
+    spawn_inbox_(std::make_unique<LockFreeLinkedList<std::shared_ptr<Fiber>>>()),
     io_manager_(std::unique_ptr<IOManager>(new IOManager())),
     timer_wheel_(std::unique_ptr<TimerWheel>(new TimerWheel())) {
     io_manager_->init();
+    if (scheduler_->high_res_timer_) {
+        // 支持epoll_pwait2时直接按纳秒超时等待，不需要timerfd
+        hires_timer_.reset(new HighResTimer(*io_manager_, !io_manager_->supportsPreciseWait()));
+    }
 }
 
 FiberConsumer::~FiberConsumer() { stop(); }
@@ -46,6 +60,15 @@ void FiberConsumer::stop() {
     while (auto task = queue_->pop_front_lockfree().value_or(nullptr)) {
         task->resume();
     }
+    while (auto task = spawn_inbox_->pop_front_lockfree().value_or(nullptr)) {
+        task->resume();
+    }
+    while (auto task = spawn_queue_->steal().value_or(nullptr)) {
+        task->resume();
+    }
+    while (auto task = nextTask()) {
+        task->resume();
+    }
 }
 
 bool FiberConsumer::schedule(Fiber::ptr fiber) {
@@ -61,41 +84,146 @@ bool FiberConsumer::schedule(Fiber::ptr fiber) {
     }
 
     // return queue_->try_enqueue(fiber);
+    FIBER_PROBE2(schedule, id_, fiber->getId());
+    stampEnqueue(fiber);
     queue_->push_back_lockfree(fiber);
-    io_manager_->wakeUpEpoll();
+    // 本线程投递时consumer必然会在下一次epoll_wait之前处理队列，不需要eventfd唤醒
+    if (!isLocal()) {
+        io_manager_->wakeUpEpoll();
+    }
+    return true;
+}
+
+bool FiberConsumer::spawn(Fiber::ptr fiber) {
+    if (!running_.load(std::memory_order_acquire)) {
+        LOG_WARN("[FiberConsumer] spawning fiber when FiberConsumer is not setup, loss fiber!");
+        return true;
+    }
+
+    FIBER_PROBE2(schedule, id_, fiber->getId());
+    stampEnqueue(fiber);
+    if (isLocal()) {
+        spawn_queue_->push(std::move(fiber));
+        wakeIdlePeer();
+    } else {
+        spawn_inbox_->push_back_lockfree(std::move(fiber));
+        io_manager_->wakeUpEpoll();
+    }
+    return true;
+}
+
+bool FiberConsumer::spawnBatch(std::vector<Fiber::ptr> &fibers) {
+    if (!running_.load(std::memory_order_acquire)) {
+        LOG_WARN("[FiberConsumer] spawning fibers when FiberConsumer is not setup, loss {} fibers!", fibers.size());
+        return true;
+    }
+
+    if (scheduler_->admission_enabled_) {
+        const auto now = Fiber::Clock::now();
+        for (auto &fiber: fibers) {
+            fiber->enqueue_time_ = now;
+        }
+    }
+    if (isLocal()) {
+        spawn_queue_->push_batch(fibers.begin(), fibers.end());
+        wakeIdlePeer();
+    } else {
+        spawn_inbox_->push_back_batch_lockfree(fibers.begin(), fibers.end());
+        io_manager_->wakeUpEpoll();
+    }
+    fibers.clear();
     return true;
 }
 
 size_t FiberConsumer::getQueueSize() const {
     // return queue_->size_approx();
-    return queue_->size();
+    return queue_->size() + spawn_queue_->size() + spawn_inbox_->size();
 }
 
 auto FiberConsumer::popTask() -> std::optional<Fiber::ptr> {
-    if (queue_->size() > 5) {
-        return queue_->pop_front_lockfree();
+    // thread-per-core模式下fiber之间共享的同步原语都是单线程的，不允许fiber离开spawn它的consumer
+    if constexpr (!kLocalThreadSafe) {
+        return {};
+    }
+    if (spawn_queue_->size() > kStealThreshold) {
+        return spawn_queue_->steal();
     }
     return {};
 }
 
+FiberConsumer *FiberConsumer::current() { return current_; }
+
 int FiberConsumer::id() const { return id_; }
 
 void FiberConsumer::consumerLoop() {
     LOG_DEBUG("FiberConsumer {} started", id_);
+    current_ = this;
+    rcu::consumerOnline(id_);
+    profiler::consumerOnline(id_);
 
     while (running_.load(std::memory_order_acquire)) {
+        // 每轮迭代开始时本consumer上没有fiber在运行，是RCU的静止点
+        rcu::quiescent(id_);
         processTask();
-        auto timeout_ms = timer_wheel_->getNextTimeOutMs();
-        io_manager_->processEvents(timeout_ms);
+        // 本地没有活可干时，从其他consumer窃取新spawn的fiber
+        if (stealTasks()) {
+            processTask();
+        }
+        // 忙轮询期间已经有事件、任务或定时器就绪时，跳过这一轮的阻塞等待
+        if (!busyPoll()) {
+            auto timeout_ms = timer_wheel_->getNextTimeOutMs();
+            // 先标记空闲再检查其他consumer的spawn队列：spawn方先push再看idle_，两边至少有一方能看到对方
+            idle_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (peersHaveStealable()) {
+                timeout_ms = 0;
+            }
+            if (hires_timer_) {
+                io_manager_->processEvents(hires_timer_->waitTimeout(std::chrono::milliseconds(timeout_ms)));
+            } else {
+                io_manager_->processEvents(static_cast<int>(timeout_ms));
+            }
+            idle_.store(false, std::memory_order_relaxed);
+        }
+        if (hires_timer_) {
+            hires_timer_->expire();
+        }
         // process newly wakeups
         processTask();
         timer_wheel_->tick();
     }
 
+    profiler::consumerOffline(id_);
+    rcu::consumerOffline(id_);
     Fiber::ResetMainFiber();
+    current_ = nullptr;
     LOG_DEBUG("FiberConsumer {} stopped", id_);
 }
 
+void FiberConsumer::setBusyPoll(std::chrono::microseconds window) {
+    busy_poll_us_.store(std::max<int64_t>(window.count(), 0), std::memory_order_relaxed);
+}
+
+bool FiberConsumer::busyPoll() {
+    auto window = std::chrono::microseconds(busy_poll_us_.load(std::memory_order_relaxed));
+    if (window.count() <= 0) {
+        return false;
+    }
+
+    // 其他线程投递fiber时会写wakeup_fd_，所以零超时的epoll_wait同时覆盖了IO就绪和跨线程投递
+    auto deadline = std::chrono::steady_clock::now() + window;
+    do {
+        if (io_manager_->processEvents(0) > 0 || getQueueSize() > 0) {
+            return true;
+        }
+        if (timer_wheel_->getNextTimeOutMs() == 0 || (hires_timer_ && hires_timer_->waitTimeout(window).count() == 0)) {
+            return true;
+        }
+    } while (running_.load(std::memory_order_acquire) && std::chrono::steady_clock::now() < deadline);
+
+    return false;
+}
+
 void FiberConsumer::processTask() {
     // Lock-free地从队列获取任务
     // if (!queue_->try_dequeue(task)) {
@@ -104,11 +232,12 @@ void FiberConsumer::processTask() {
     //     return;
     // }
 
-    Fiber::ptr task = queue_->pop_front_lockfree().value_or(nullptr);
+    Fiber::ptr task = nextTask();
     while (task) {
         if (task->GetConsumerId().has_value()) {
             assert(task->GetConsumerId().value() == id() && "Fiber scheduled across thread!");
         }
+        observeSojourn(task);
         task->SetConsumerId(id());
         // 执行fiber任务
         task->resume();
@@ -118,13 +247,169 @@ void FiberConsumer::processTask() {
             // while (!queue_->enqueue(task)) {
             //     std::this_thread::yield();
             // }
+            stampEnqueue(task);
             queue_->push_back_lockfree(task);
         }
 
         // 如果状态是DONE，fiber已完成，task的shared_ptr会自动释放
-        task = queue_->pop_front_lockfree().value_or(nullptr);
+        task = nextTask();
+    }
+
+    // 队列已经排空，说明没有积压
+    resetSojourn();
+}
+
+Fiber::ptr FiberConsumer::nextTask() {
+    refillReady();
+
+    // 同一类内按EDF排序；连续kEdfStreak个带deadline的fiber之后让FIFO类跑一个，避免饿死
+    if (!edf_queue_.empty() && (fifo_queue_.empty() || edf_streak_ < kEdfStreak)) {
+        ++edf_streak_;
+        Fiber::ptr task = edf_queue_.top();
+        edf_queue_.pop();
+        return task;
     }
 
+    edf_streak_ = 0;
+    if (fifo_queue_.empty()) {
+        return nullptr;
+    }
+    Fiber::ptr task = std::move(fifo_queue_.front());
+    fifo_queue_.pop_front();
+    return task;
+}
+
+void FiberConsumer::refillReady() {
+    // 其他线程spawn过来的fiber先转进可窃取的spawn队列
+    while (auto task = spawn_inbox_->pop_front_lockfree()) {
+        spawn_queue_->push(std::move(*task));
+    }
+
+    // 本地就绪队列还有fiber时不搬，spawn队列里的fiber留着给其他consumer窃取
+    if (!edf_queue_.empty() || !fifo_queue_.empty()) {
+        return;
+    }
+
+    // 每次只搬一小批；spawn队列从所有者一端（尾部）取，头部较早的fiber仍然可以被窃取
+    for (size_t i = 0; i < kRefillBatch; ++i) {
+        prefer_spawn_ = !prefer_spawn_;
+
+        auto task = prefer_spawn_ ? spawn_queue_->pop() : queue_->pop_front_lockfree();
+        if (!task) {
+            task = prefer_spawn_ ? queue_->pop_front_lockfree() : spawn_queue_->pop();
+        }
+        if (!task) {
+            return;
+        }
+
+        if ((*task)->GetDeadline()) {
+            edf_queue_.push(std::move(*task));
+        } else {
+            fifo_queue_.push_back(std::move(*task));
+        }
+    }
+}
+
+bool FiberConsumer::stealTasks() {
+    if constexpr (!kLocalThreadSafe) {
+        return false;
+    }
+
+    auto &consumers = scheduler_->consumers_;
+    const size_t count = consumers.size();
+
+    for (size_t i = 1; i < count; ++i) {
+        FiberConsumer *victim = consumers[(id_ + i) % count].get();
+
+        size_t stolen = 0;
+        while (stolen < kStealBatch) {
+            auto task = victim->popTask();
+            if (!task) {
+                break;
+            }
+            spawn_queue_->push(std::move(*task));
+            ++stolen;
+        }
+
+        if (stolen > 0) {
+            wakeIdlePeer();
+            // LOG_DEBUG("FiberConsumer {} stole {} fibers from {}", id_, stolen, victim->id());
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FiberConsumer::peersHaveStealable() const {
+    if constexpr (!kLocalThreadSafe) {
+        return false;
+    }
+
+    for (auto &consumer: scheduler_->consumers_) {
+        if (consumer.get() != this && consumer->spawn_queue_->size() > kStealThreshold) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void FiberConsumer::wakeIdlePeer() {
+    if constexpr (!kLocalThreadSafe) {
+        return;
+    }
+    if (spawn_queue_->size() <= kStealThreshold) {
+        return;
+    }
+
+    // 与consumerLoop中idle_的store配对，保证push先于读取idle_
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto &consumers = scheduler_->consumers_;
+    const size_t count = consumers.size();
+    for (size_t i = 1; i < count; ++i) {
+        FiberConsumer *peer = consumers[(id_ + i) % count].get();
+        bool idle = true;
+        // 只唤醒一个，被唤醒的consumer窃取后自己的spawn队列超过阈值时会继续唤醒下一个
+        if (peer->idle_.load(std::memory_order_relaxed) &&
+            peer->idle_.compare_exchange_strong(idle, false, std::memory_order_acq_rel)) {
+            peer->io_manager_->wakeUpEpoll();
+            return;
+        }
+    }
+}
+
+void FiberConsumer::stampEnqueue(const Fiber::ptr &fiber) const {
+    if (scheduler_->admission_enabled_) {
+        fiber->enqueue_time_ = Fiber::Clock::now();
+    }
+}
+
+void FiberConsumer::observeSojourn(const Fiber::ptr &fiber) {
+    if (!scheduler_->admission_enabled_) {
+        return;
+    }
+
+    // CoDel：只要有一个样本低于目标值，说明队列能排空，不算过载；
+    // 连续interval时间内所有样本都高于目标值（即最小排队时延高于目标值）才进入过载
+    const auto now = Fiber::Clock::now();
+    if (now - fiber->enqueue_time_ < scheduler_->admission_target_) {
+        resetSojourn();
+        return;
+    }
+
+    if (first_above_time_ == Fiber::TimePoint{}) {
+        first_above_time_ = now + scheduler_->admission_interval_;
+    } else if (now >= first_above_time_ && !overloaded_.load(std::memory_order_relaxed)) {
+        overloaded_.store(true, std::memory_order_relaxed);
+        LOG_WARN("[FiberConsumer] consumer {} overloaded, shedding new root fibers", id_);
+    }
+}
+
+void FiberConsumer::resetSojourn() {
+    first_above_time_ = {};
+    if (overloaded_.load(std::memory_order_relaxed)) {
+        overloaded_.store(false, std::memory_order_relaxed);
+        LOG_INFO("[FiberConsumer] consumer {} recovered from overload", id_);
+    }
 }
 
 } // namespace fiber
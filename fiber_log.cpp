@@ -0,0 +1,402 @@
+#include "fiber_log.h"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <sys/uio.h>
+#include <vector>
+#include "fiber.h"
+#include "fiber_consumer.h"
+#include "io_fiber.h"
+#include "parking_lot.h"
+#include "scheduler.h"
+#include "sync.h"
+
+namespace fiber::log {
+
+namespace detail {
+std::atomic<uint8_t> level{static_cast<uint8_t>(Level::Info)};
+} // namespace detail
+
+namespace {
+
+// 一条记录固定256字节，text以换行结尾
+struct Record {
+    int64_t realtime_ns;
+    uint64_t fiber_id;
+    uint16_t size;
+    Level level;
+    char text[237];
+};
+static_assert(sizeof(Record) == 256);
+
+constexpr size_t kBatchRecords = 512; // 每个记录占两个iovec，一批不超过IOV_MAX
+constexpr size_t kHeaderSize = 64;
+
+// 每个consumer一个：consumer线程是唯一的写者，flusher是唯一的读者
+struct alignas(CACHE_LINE_SIZE) Ring {
+    std::unique_ptr<Record[]> records;
+    size_t mask{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head{0}; // 已写入的记录数
+    std::atomic<uint64_t> dropped{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail{0}; // 已写出的记录数
+};
+
+std::mutex g_mutex; // 保护start/stop/attachConsumers
+std::unique_ptr<Ring[]> g_rings;
+size_t g_ring_count{0};
+std::atomic<bool> g_running{false};
+std::atomic<int> g_fd{STDERR_FILENO};
+std::atomic<bool> g_fd_private{false}; // g_fd是sink自己打开的，可以交给IO::writev设成非阻塞
+int g_user_fd{STDERR_FILENO}; // Options::fd，stop之后恢复为写出目标
+int64_t g_flush_interval_ms{10};
+std::atomic<uint64_t> g_dropped{0};
+
+std::atomic<uint32_t> g_wake{0}; // 环过半或停止时递增，唤醒flusher
+FiberMutex g_drain_mutex; // flusher和flush()互斥，持锁期间可能挂起在IO::writev上
+
+const char kLevelNames[] = "DIWE-";
+
+int64_t realtimeNs() {
+    timespec ts{};
+    ::clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+// "2025-12-23 10:00:00.123456 I c1 f42 "，同一秒内复用日期时间部分
+size_t formatHeader(char *out, int64_t realtime_ns, Level level, int consumer_id, uint64_t fiber_id) {
+    static thread_local time_t cached_second = -1;
+    static thread_local char cached_prefix[24];
+    const time_t second = static_cast<time_t>(realtime_ns / 1'000'000'000);
+    if (second != cached_second) {
+        tm local{};
+        ::localtime_r(&second, &local);
+        std::strftime(cached_prefix, sizeof(cached_prefix), "%Y-%m-%d %H:%M:%S", &local);
+        cached_second = second;
+    }
+    int n = std::snprintf(out, kHeaderSize, "%s.%06ld %c c%d f%lu ", cached_prefix,
+                          static_cast<long>(realtime_ns % 1'000'000'000 / 1000), kLevelNames[static_cast<int>(level)],
+                          consumer_id, static_cast<unsigned long>(fiber_id));
+    return static_cast<size_t>(std::clamp(n, 0, static_cast<int>(kHeaderSize) - 1));
+}
+
+size_t append(char *out, size_t pos, size_t cap, const char *data, size_t size) {
+    size = std::min(size, cap - pos);
+    std::memcpy(out + pos, data, size);
+    return pos + size;
+}
+
+size_t appendArg(char *out, size_t pos, size_t cap, const detail::Arg &arg) {
+    using Type = detail::Arg::Type;
+    char buffer[32];
+    std::to_chars_result result{buffer, {}};
+    switch (arg.type) {
+        case Type::None:
+            return pos;
+        case Type::Int:
+            result = std::to_chars(buffer, buffer + sizeof(buffer), arg.i);
+            break;
+        case Type::Uint:
+            result = std::to_chars(buffer, buffer + sizeof(buffer), arg.u);
+            break;
+        case Type::Double:
+            result = std::to_chars(buffer, buffer + sizeof(buffer), arg.d);
+            break;
+        case Type::Bool:
+            return arg.b ? append(out, pos, cap, "true", 4) : append(out, pos, cap, "false", 5);
+        case Type::Char:
+            return append(out, pos, cap, &arg.c, 1);
+        case Type::String:
+            return append(out, pos, cap, arg.s.data, arg.s.size);
+        case Type::Pointer:
+            buffer[0] = '0';
+            buffer[1] = 'x';
+            result = std::to_chars(buffer + 2, buffer + sizeof(buffer), reinterpret_cast<uintptr_t>(arg.p), 16);
+            break;
+    }
+    return append(out, pos, cap, buffer, static_cast<size_t>(result.ptr - buffer));
+}
+
+// 通过/proc/self/fd重新打开，得到独立的打开文件描述。不能用dup：dup出的fd和原fd共享O_NONBLOCK，
+// IO::writev会把进程的stderr一起设成非阻塞。socket等无法重新打开的fd返回-1
+int openPrivateFd(int fd) {
+    const int flags = ::fcntl(fd, F_GETFL);
+    if (flags < 0 || (flags & O_ACCMODE) == O_RDONLY) {
+        return -1;
+    }
+    char path[32];
+    std::snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    // O_NONBLOCK：没有读端的FIFO直接失败，而不是阻塞在open上
+    return ::open(path, (flags & (O_ACCMODE | O_APPEND)) | O_NONBLOCK | O_CLOEXEC);
+}
+
+// 写完整个iovec数组，EAGAIN时（fd被IO::writev设成了非阻塞）用poll等待；外部线程和调度循环里使用
+void writeAllBlocking(int fd, iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = ::writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                pollfd pfd{fd, POLLOUT, 0};
+                ::poll(&pfd, 1, -1);
+                continue;
+            }
+            return;
+        }
+        auto remain = static_cast<size_t>(n);
+        while (count > 0 && remain >= iov->iov_len) {
+            remain -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + remain;
+            iov->iov_len -= remain;
+        }
+    }
+}
+
+void writeBatch(iovec *iov, int count) {
+    if (count == 0) {
+        return;
+    }
+    const int fd = g_fd.load(std::memory_order_relaxed);
+    // 调用方的fd不能被设成非阻塞，只能同步写
+    if (g_fd_private.load(std::memory_order_relaxed) && Fiber::InSchedulableFiber()) {
+        IO::writev(fd, iov, count);
+    } else {
+        writeAllBlocking(fd, iov, count);
+    }
+}
+
+// 把所有环里的记录写出，调用方持有g_drain_mutex
+void drain() {
+    std::vector<iovec> iov;
+    iov.reserve(2 * kBatchRecords);
+    std::vector<char> headers(kBatchRecords * kHeaderSize);
+    char dropped_line[96];
+
+    for (size_t id = 0; id < g_ring_count; ++id) {
+        Ring &ring = g_rings[id];
+        if (!ring.records) {
+            continue;
+        }
+
+        uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+        const uint64_t head = ring.head.load(std::memory_order_acquire);
+        while (tail != head) {
+            const uint64_t end = std::min<uint64_t>(head, tail + kBatchRecords);
+            iov.clear();
+            for (uint64_t seq = tail; seq != end; ++seq) {
+                Record &record = ring.records[seq & ring.mask];
+                char *header = headers.data() + (seq - tail) * kHeaderSize;
+                size_t header_size =
+                        formatHeader(header, record.realtime_ns, record.level, static_cast<int>(id), record.fiber_id);
+                iov.push_back({header, header_size});
+                iov.push_back({record.text, record.size});
+            }
+            writeBatch(iov.data(), static_cast<int>(iov.size()));
+            // 写出之后才把记录还给生产者
+            ring.tail.store(end, std::memory_order_release);
+            tail = end;
+        }
+
+        if (uint64_t dropped = ring.dropped.exchange(0, std::memory_order_relaxed)) {
+            g_dropped.fetch_add(dropped, std::memory_order_relaxed);
+            size_t header_size = formatHeader(headers.data(), realtimeNs(), Level::Warn, static_cast<int>(id), 0);
+            int n = std::snprintf(dropped_line, sizeof(dropped_line), "[fiber_log] dropped %lu records\n",
+                                  static_cast<unsigned long>(dropped));
+            iovec line[2] = {{headers.data(), header_size}, {dropped_line, static_cast<size_t>(n)}};
+            writeBatch(line, 2);
+        }
+    }
+}
+
+// 不经过环直接写出：外部线程、调度器启动前、以及停止之后
+void writeDirect(Level level, std::string_view fmt, const detail::Arg *args, size_t count) {
+    Record record;
+    record.size = static_cast<uint16_t>(detail::format(record.text, sizeof(record.text) - 1, fmt, args, count));
+    record.text[record.size++] = '\n';
+    char header[kHeaderSize];
+    auto consumer = FiberConsumer::current();
+    auto fiber = Fiber::GetCurrentFiberRaw();
+    size_t header_size = formatHeader(header, realtimeNs(), level, consumer ? consumer->id() : -1,
+                                      fiber ? fiber->getId() : 0);
+    iovec iov[2] = {{header, header_size}, {record.text, record.size}};
+    writeAllBlocking(g_fd.load(std::memory_order_relaxed), iov, 2);
+}
+
+void flusherLoop() {
+    while (g_running.load(std::memory_order_acquire)) {
+        const uint32_t seq = g_wake.load(std::memory_order_acquire);
+        {
+            std::lock_guard guard(g_drain_mutex);
+            drain();
+        }
+        fiber::wait_on(g_wake, seq, g_flush_interval_ms);
+    }
+}
+
+} // namespace
+
+namespace detail {
+
+size_t format(char *out, size_t cap, std::string_view fmt, const Arg *args, size_t count) {
+    size_t pos = 0;
+    size_t next = 0;
+    for (size_t i = 0; i < fmt.size() && pos < cap; ++i) {
+        const char ch = fmt[i];
+        if (ch == '{' && i + 1 < fmt.size() && fmt[i + 1] == '{') {
+            out[pos++] = '{';
+            ++i;
+        } else if (ch == '}' && i + 1 < fmt.size() && fmt[i + 1] == '}') {
+            out[pos++] = '}';
+            ++i;
+        } else if (ch == '{') {
+            // 跳过格式说明，不支持宽度、精度等
+            size_t close = fmt.find('}', i);
+            if (close == std::string_view::npos) {
+                break;
+            }
+            if (next < count) {
+                pos = appendArg(out, pos, cap, args[next++]);
+            }
+            i = close;
+        } else {
+            out[pos++] = ch;
+        }
+    }
+    return pos;
+}
+
+void write(Level level, std::string_view fmt, const Arg *args, size_t count) {
+    auto consumer = FiberConsumer::current();
+    if (!g_running.load(std::memory_order_acquire) || !consumer ||
+        static_cast<size_t>(consumer->id()) >= g_ring_count) {
+        writeDirect(level, fmt, args, count);
+        return;
+    }
+
+    Ring &ring = g_rings[consumer->id()];
+    const uint64_t head = ring.head.load(std::memory_order_relaxed);
+    const uint64_t used = head - ring.tail.load(std::memory_order_acquire);
+    if (used > ring.mask) {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Record &record = ring.records[head & ring.mask];
+    auto fiber = Fiber::GetCurrentFiberRaw();
+    record.realtime_ns = realtimeNs();
+    record.fiber_id = fiber ? fiber->getId() : 0;
+    record.level = level;
+    record.size = static_cast<uint16_t>(format(record.text, sizeof(record.text) - 1, fmt, args, count));
+    record.text[record.size++] = '\n';
+    ring.head.store(head + 1, std::memory_order_release);
+
+    // 环刚过半时提前唤醒flusher，之外只靠flush_interval定期写出
+    if (used + 1 == (ring.mask + 1) / 2) {
+        g_wake.fetch_add(1, std::memory_order_release);
+        fiber::notify_one(&g_wake);
+    }
+}
+
+} // namespace detail
+
+bool start(const Options &options) {
+    std::lock_guard<std::mutex> guard(g_mutex);
+    if (g_running.load(std::memory_order_acquire)) {
+        return false;
+    }
+    auto &scheduler = Scheduler::getInst();
+    if (!scheduler.isRunning() || g_ring_count == 0) {
+        return false;
+    }
+
+    const size_t capacity = std::bit_ceil(std::max<size_t>(options.records_per_consumer, 2));
+    for (size_t i = 0; i < g_ring_count; ++i) {
+        Ring &ring = g_rings[i];
+        if (!ring.records) {
+            ring.records = std::make_unique<Record[]>(capacity);
+            ring.mask = capacity - 1;
+        }
+    }
+    g_user_fd = options.fd;
+    const int private_fd = openPrivateFd(options.fd);
+    g_fd.store(private_fd >= 0 ? private_fd : options.fd, std::memory_order_relaxed);
+    g_fd_private.store(private_fd >= 0, std::memory_order_relaxed);
+    g_flush_interval_ms = std::max<int64_t>(options.flush_interval.count(), 1);
+    set_level(options.level);
+
+    int consumer = options.flusher_consumer;
+    if (consumer < 0 || consumer >= scheduler.getWorkerCount()) {
+        consumer = scheduler.getWorkerCount() - 1;
+    }
+    g_running.store(true, std::memory_order_release);
+    // flusher常驻到stop，不能继承调用start的fiber的deadline
+    Fiber::go_system(flusherLoop, consumer);
+    return true;
+}
+
+void stop() {
+    {
+        std::lock_guard<std::mutex> guard(g_mutex);
+        if (!g_running.exchange(false, std::memory_order_acq_rel)) {
+            return;
+        }
+    }
+    g_wake.fetch_add(1, std::memory_order_release);
+    fiber::notify_all(&g_wake);
+    std::lock_guard drain_guard(g_drain_mutex);
+    drain();
+
+    // 之后的日志同步写到调用方的fd，关闭sink自己打开的fd；持有g_drain_mutex，不会有drain正在用它
+    std::lock_guard<std::mutex> guard(g_mutex);
+    if (!g_running.load(std::memory_order_acquire) && g_fd_private.exchange(false, std::memory_order_relaxed)) {
+        ::close(g_fd.exchange(g_user_fd, std::memory_order_relaxed));
+    }
+}
+
+bool running() { return g_running.load(std::memory_order_acquire); }
+
+void flush() {
+    std::lock_guard guard(g_drain_mutex);
+    drain();
+}
+
+void set_level(Level level) { detail::level.store(static_cast<uint8_t>(level), std::memory_order_relaxed); }
+
+Level level() { return static_cast<Level>(detail::level.load(std::memory_order_relaxed)); }
+
+uint64_t dropped() {
+    uint64_t total = g_dropped.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> guard(g_mutex);
+    for (size_t i = 0; i < g_ring_count; ++i) {
+        total += g_rings[i].dropped.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void attachConsumers(int count) {
+    std::lock_guard<std::mutex> guard(g_mutex);
+    if (static_cast<size_t>(count) <= g_ring_count) {
+        return;
+    }
+    // 环只增不减，正在运行时不替换（producer不加锁访问g_rings）
+    if (g_running.load(std::memory_order_acquire)) {
+        return;
+    }
+    g_rings = std::make_unique<Ring[]>(count);
+    g_ring_count = count;
+}
+
+} // namespace fiber::log
@@ -0,0 +1,132 @@
+#include "hires_timer.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "io_manager.h"
+#include "serika/basic/logger.h"
+
+namespace fiber {
+
+HighResTimer::HighResTimer(IOManager &io_manager, bool use_timerfd) : io_manager_(io_manager) {
+    if (!use_timerfd) {
+        return;
+    }
+
+    timer_fd_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0) {
+        LOG_ERROR("timerfd_create failed: {}", strerror(errno));
+        throw std::runtime_error("Failed to create timerfd");
+    }
+
+    // 电平触发的常驻监听，到期后在回调里读空timerfd
+    io_manager_.addWatch(timer_fd_, EPOLLIN, [this]() {
+        uint64_t expirations;
+        while (::read(timer_fd_, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+        }
+        armed_ = TimePoint::max();
+        expire();
+    });
+}
+
+HighResTimer::~HighResTimer() {
+    if (timer_fd_ >= 0) {
+        io_manager_.removeWatch(timer_fd_);
+        ::close(timer_fd_);
+    }
+}
+
+HighResTimer::TimerId HighResTimer::addAt(TimePoint deadline, Callback cb) {
+    TimerId id = next_id_++;
+    callbacks_.emplace(id, std::move(cb));
+    heap_.push(Entry{deadline, id});
+
+    if (timer_fd_ >= 0 && deadline < armed_) {
+        program();
+    }
+    return id;
+}
+
+void HighResTimer::cancel(TimerId id) {
+    // timerfd保持原来的编程，提前醒来时发现没有到期的定时器会重新编程
+    callbacks_.erase(id);
+}
+
+bool HighResTimer::nextDeadline(TimePoint &deadline) {
+    while (!heap_.empty()) {
+        const Entry &top = heap_.top();
+        if (callbacks_.contains(top.id)) {
+            deadline = top.deadline;
+            return true;
+        }
+        heap_.pop();
+    }
+    return false;
+}
+
+std::chrono::nanoseconds HighResTimer::waitTimeout(std::chrono::nanoseconds max) {
+    TimePoint deadline;
+    if (!nextDeadline(deadline)) {
+        return max;
+    }
+    auto remaining = deadline - Clock::now();
+    if (remaining <= Clock::duration::zero()) {
+        return std::chrono::nanoseconds::zero();
+    }
+    return std::min(max, std::chrono::duration_cast<std::chrono::nanoseconds>(remaining));
+}
+
+void HighResTimer::expire() {
+    auto now = Clock::now();
+    TimePoint deadline;
+    while (nextDeadline(deadline) && deadline <= now) {
+        TimerId id = heap_.top().id;
+        heap_.pop();
+
+        auto it = callbacks_.find(id);
+        Callback callback = std::move(it->second);
+        callbacks_.erase(it);
+        try {
+            callback();
+        } catch (const std::exception &e) {
+            LOG_ERROR("HighResTimer callback exception: {}", e.what());
+        } catch (...) {
+            LOG_ERROR("HighResTimer callback unknown exception");
+        }
+    }
+
+    if (timer_fd_ >= 0) {
+        program();
+    }
+}
+
+void HighResTimer::program() {
+    TimePoint deadline;
+    if (!nextDeadline(deadline)) {
+        deadline = TimePoint::max();
+    }
+    if (deadline == armed_) {
+        return;
+    }
+
+    itimerspec spec{};
+    if (deadline != TimePoint::max()) {
+        // steady_clock即CLOCK_MONOTONIC，直接用绝对时间编程；全零会解除定时，已过期的时刻至少设为1ns
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+        if (ns <= 0) {
+            ns = 1;
+        }
+        spec.it_value.tv_sec = static_cast<time_t>(ns / 1000000000);
+        spec.it_value.tv_nsec = static_cast<long>(ns % 1000000000);
+    }
+
+    if (::timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+        LOG_ERROR("timerfd_settime failed: {}", strerror(errno));
+        return;
+    }
+    armed_ = deadline;
+}
+
+} // namespace fiber
@@ -0,0 +1,110 @@
+//
+// Created by inory on 12/20/25.
+//
+
+#ifndef FIBER_ACCOUNTING_H
+#define FIBER_ACCOUNTING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace fiber {
+class Fiber;
+}
+namespace fiber::accounting {
+
+/**
+ * 按fiber和标签统计CPU时间
+ *
+ * 开启后（fiber.accounting.enabled或accounting::enable()）每次Fiber::resume都读取TSC，
+ * fiber切回调度器时把这段周期数累加到fiber自身（Fiber::GetCpuCycles）和所在consumer的统计表中。
+ * 统计表以fiber的标签（Fiber::SetTag，例如租户id）为键，没有标签时以trace id为键，
+ * 用于按租户计费、找出共享进程里的吵闹邻居：
+ *   Fiber::GetCurrentFiberPtr()->SetTag(tenant_id);          // 请求入口设置，子fiber继承
+ *   ...
+ *   for (auto &[tag, usage]: accounting::top(10)) {
+ *       LOG_INFO("tenant {} cpu {}us", tag, usage.time().count() / 1000);
+ *   }
+ *
+ * 注意：以trace id为键时每个请求一条记录，需要定期reset；
+ * 只统计fiber本身运行的时间，调度循环、IO回调和定时器回调不计入任何fiber
+ */
+
+struct Usage {
+    uint64_t cycles{0}; // TSC周期数
+    uint64_t slices{0}; // 被调度运行的次数
+
+    std::chrono::nanoseconds time() const;
+};
+
+namespace detail {
+extern std::atomic<bool> enabled;
+} // namespace detail
+
+/**
+ * @brief 当前时间戳（x86上为TSC，其他平台为steady_clock纳秒）
+ */
+inline uint64_t now() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+inline bool enabled() noexcept { return detail::enabled.load(std::memory_order_relaxed); }
+
+/**
+ * @brief 开启或关闭统计，已有的数据保留
+ */
+void enable(bool on = true);
+
+/**
+ * @brief 把周期数换算成时间，按调度器启动以来TSC和steady_clock的比值估算，不会阻塞
+ */
+std::chrono::nanoseconds to_duration(uint64_t cycles);
+
+/**
+ * @brief 所有consumer合并后的统计，键为标签（没有标签时为trace id）
+ */
+std::unordered_map<uint64_t, Usage> snapshot();
+
+/**
+ * @brief 单个consumer的统计
+ */
+std::unordered_map<uint64_t, Usage> snapshot(int consumer_id);
+
+/**
+ * @brief 合并后CPU周期数最多的n个键，从多到少
+ */
+std::vector<std::pair<uint64_t, Usage>> top(size_t n);
+
+/**
+ * @brief 清空所有consumer的统计表（不影响fiber自身的累计值）
+ */
+void reset();
+
+// ==================== 调度器使用 ====================
+
+/**
+ * @brief 调度器启动consumer前调用，分配每个consumer的统计表
+ */
+void attachConsumers(int count);
+
+/**
+ * @brief fiber运行了cycles个周期后切回调度器时调用（consumer线程上）
+ */
+void charge(const Fiber &fiber, uint64_t cycles);
+
+} // namespace fiber::accounting
+
+#endif // FIBER_ACCOUNTING_H
@@ -0,0 +1,133 @@
+//
+// Created by inory on 12/18/25.
+//
+
+#ifndef FIBER_BUFFER_RING_H
+#define FIBER_BUFFER_RING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "lockfree/lockfree_linked_list.h"
+
+namespace fiber {
+class FiberConsumer;
+class IOManager;
+class Scheduler;
+class BufferRing;
+class IO;
+}
+namespace fiber {
+
+/**
+ * @brief IO::read_any返回的缓冲区
+ *
+ * 缓冲区属于某个consumer的BufferRing，析构（或reset）时归还；可以转移给其他consumer上的fiber，
+ * 跨线程归还会先挂到无锁队列上，由所属consumer回收。size()为0表示对端关闭（EOF）
+ */
+class IOBuffer {
+public:
+    IOBuffer() = default;
+    ~IOBuffer() { reset(); }
+
+    IOBuffer(IOBuffer &&other) noexcept;
+    IOBuffer &operator=(IOBuffer &&other) noexcept;
+    IOBuffer(const IOBuffer &) = delete;
+    IOBuffer &operator=(const IOBuffer &) = delete;
+
+    char *data() { return data_; }
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    /**
+     * @brief 提前归还缓冲区
+     */
+    void reset();
+
+private:
+    friend BufferRing;
+
+    IOBuffer(BufferRing *owner, char *data, size_t size, int32_t bid) :
+        owner_(owner), data_(data), size_(size), bid_(bid) {}
+
+    BufferRing *owner_{nullptr};
+    char *data_{nullptr};
+    size_t size_{0};
+    int32_t bid_{-1}; // io_uring的buffer id，-1表示池化缓冲区
+};
+
+/**
+ * @brief 每个consumer一个的读缓冲区环（IO::read_any使用）
+ *
+ * 大量空闲连接各自阻塞在IO::read上时，每个连接都要预留自己的读缓冲区，内存被缓冲区占满。
+ * BufferRing通过io_uring的provided buffer ring（IORING_REGISTER_PBUF_RING，5.19+）把一组缓冲区交给内核，
+ * 读请求不带缓冲区，数据真正到达时内核才从环里挑一个，所以缓冲区数量只和同时在处理的数据量有关，和连接数无关。
+ * io_uring的完成通知通过eventfd注册在本consumer的IOManager上，等待的fiber挂在parking lot上。
+ *
+ * 内核不支持io_uring（或不支持provided buffer ring）、关闭了fiber.io.uring、环里的缓冲区都在使用中、
+ * 或者在途的读请求多到可能让CQ溢出时，退回到epoll等待可读后再从缓冲池里取一个缓冲区读取。
+ * 注意：只能在所属consumer线程上（fiber中）读取，缓冲区可以在任意线程归还
+ */
+class BufferRing {
+public:
+    friend Scheduler;
+    friend IOBuffer;
+    friend IO;
+
+    ~BufferRing();
+
+    BufferRing(const BufferRing &) = delete;
+    BufferRing &operator=(const BufferRing &) = delete;
+
+    /**
+     * @brief 是否在使用io_uring的provided buffer ring
+     */
+    bool usesUring() const { return uring_ != nullptr; }
+
+    size_t bufferSize() const { return buffer_size_; }
+
+private:
+    struct Uring;
+    struct Request;
+    struct Released {
+        char *data{nullptr};
+        int32_t bid{-1};
+    };
+
+    BufferRing(FiberConsumer *consumer, IOManager &io_manager, unsigned entries, size_t buffer_size, bool use_uring);
+
+    // 通过io_uring读取，缓冲区由内核在数据到达时选择；超时errno=ETIMEDOUT，
+    // 环里没有空闲缓冲区或者在途请求已经占满CQ容量时errno=ENOBUFS
+    std::optional<IOBuffer> read(int fd, int64_t timeout_ms);
+    // 从缓冲池取一个bufferSize()大小的缓冲区（退回epoll路径时使用）
+    IOBuffer acquire();
+    static void resize(IOBuffer &buffer, size_t size) { buffer.size_ = size; }
+
+    void release(char *data, int32_t bid);
+    void recycle(char *data, int32_t bid);
+    void drainReleased();
+    // io_uring完成事件就绪时由IOManager调用
+    void reap();
+    void reapCompletions();
+    void cancel(uint64_t user_data);
+
+    FiberConsumer *consumer_;
+    IOManager &io_manager_;
+    const unsigned entries_;
+    const size_t buffer_size_;
+
+    std::unique_ptr<Uring> uring_;
+    uint64_t next_user_data_{1}; // 0留给取消请求
+    std::unordered_map<uint64_t, std::shared_ptr<Request>> inflight_;
+
+    std::vector<std::unique_ptr<char[]>> pool_; // 空闲的池化缓冲区，最多保留entries_个
+    LockFreeLinkedList<Released> released_; // 其他线程归还的缓冲区
+};
+
+} // namespace fiber
+
+#endif // FIBER_BUFFER_RING_H
@@ -2,15 +2,17 @@
 #define FIBER_CHANNEL_LOCKFREE_H
 
 #include <atomic>
+#include <chrono>
 #include <memory>
+#include <optional>
+#include <stdexcept>
 #include <vector>
 #include "fiber.h"
-#include "timer.h"
-#include "wait_queue.h"
+#include "parking_lot.h"
+#include "probes.h"
 
 namespace fiber {
 
-class WaitQueue;
 class SelectCase;
 
 // template<typename T>
@@ -20,6 +22,10 @@ class SelectCase;
 
 /**
  * @brief 无锁协程Channel类
+ *
+ * send/recv/close可以在外部线程调用，阻塞时挂起的是调用线程；带超时的版本依赖consumer的定时器，只能在fiber中调用。
+ * 等待使用两个事件计数字（eventcount）：先读计数再尝试收发，失败后在计数字上wait_on，
+ * 对端收发成功后递增计数并notify，读计数之后发生的唤醒不会丢失
  */
 template<typename T>
 class Channel {
@@ -61,9 +67,10 @@ private:
 
     enum class State { OPEN, CLOSED };
 
-    // 无锁环形缓冲区
+    // 无锁环形缓冲区（有界MPMC队列）：seq == pos表示可写，seq == pos + 1表示可读
     struct alignas(64) Slot {
-        std::atomic<T *> data{nullptr};
+        std::atomic<size_t> seq{0};
+        std::optional<T> data;
     };
 
     size_t capacity_;
@@ -72,11 +79,13 @@ private:
     alignas(64) std::atomic<size_t> tail_{0};
     alignas(64) std::atomic<State> state_{State::OPEN};
 
-    std::unique_ptr<WaitQueue> send_waiters_;
-    std::unique_ptr<WaitQueue> recv_waiters_;
+    // 发送方在send_seq_上等待空位，接收方在recv_seq_上等待数据
+    alignas(64) std::atomic<uint32_t> send_seq_{0};
+    alignas(64) std::atomic<uint32_t> recv_seq_{0};
 
     // 辅助方法
-    size_t next_index(size_t current) const { return (current + 1) % capacity_; }
+    void wake_sender();
+    void wake_receiver();
     bool is_full_lockfree() const;
     bool is_empty_lockfree() const;
     bool try_push_lockfree(T &&value);
@@ -86,8 +95,11 @@ private:
 // 实现
 template<typename T>
 Channel<T>::Channel(size_t capacity) :
-    capacity_(capacity == 0 ? 2 : capacity + 1), buffer_(capacity_), send_waiters_(std::make_unique<WaitQueue>()),
-    recv_waiters_(std::make_unique<WaitQueue>()) {}
+    capacity_(capacity == 0 ? 1 : capacity), buffer_(capacity_) {
+    for (size_t i = 0; i < capacity_; ++i) {
+        buffer_[i].seq.store(i, std::memory_order_relaxed);
+    }
+}
 
 template<typename T>
 Channel<T>::~Channel() {
@@ -96,52 +108,40 @@ Channel<T>::~Channel() {
 
 template<typename T>
 bool Channel<T>::send(T value) {
-    if (state_.load(std::memory_order_acquire) == State::CLOSED) {
-        return false;
-    }
-
-    if (try_push_lockfree(std::move(value))) {
-        recv_waiters_->notify_one();
-        return true;
-    }
-
     while (true) {
-        // yield cpu
-        send_waiters_->wait();
-
+        uint32_t seq = send_seq_.load(std::memory_order_acquire);
         if (state_.load(std::memory_order_acquire) == State::CLOSED) {
             return false;
         }
 
         if (try_push_lockfree(std::move(value))) {
-            recv_waiters_->notify_one();
+            wake_receiver();
             return true;
         }
+
+        // yield cpu，读取计数之后有接收（或关闭）时不会挂起
+        FIBER_PROBE1(chan_send_park, this);
+        fiber::wait_on(send_seq_, seq);
+        FIBER_PROBE1(chan_send_unpark, this);
     }
 }
 
 template<typename T>
 bool Channel<T>::recv(T &value) {
-    if (try_pop_lockfree(value)) {
-        send_waiters_->notify_one();
-        return true;
-    }
-
-    if (state_.load(std::memory_order_acquire) == State::CLOSED && is_empty_lockfree()) {
-        return false;
-    }
-
     while (true) {
-        recv_waiters_->wait();
-
+        uint32_t seq = recv_seq_.load(std::memory_order_acquire);
         if (try_pop_lockfree(value)) {
-            send_waiters_->notify_one();
+            wake_sender();
             return true;
         }
 
         if (state_.load(std::memory_order_acquire) == State::CLOSED && is_empty_lockfree()) {
             return false;
         }
+
+        FIBER_PROBE1(chan_recv_park, this);
+        fiber::wait_on(recv_seq_, seq);
+        FIBER_PROBE1(chan_recv_unpark, this);
     }
 }
 
@@ -152,7 +152,7 @@ bool Channel<T>::try_send(T value) {
     }
 
     if (try_push_lockfree(std::move(value))) {
-        recv_waiters_->notify_one();
+        wake_receiver();
         return true;
     }
 
@@ -162,7 +162,7 @@ bool Channel<T>::try_send(T value) {
 template<typename T>
 bool Channel<T>::try_recv(T &value) {
     if (try_pop_lockfree(value)) {
-        send_waiters_->notify_one();
+        wake_sender();
         return true;
     }
     return false;
@@ -171,8 +171,10 @@ bool Channel<T>::try_recv(T &value) {
 template<typename T>
 void Channel<T>::close() {
     state_.store(State::CLOSED, std::memory_order_release);
-    send_waiters_->notify_all();
-    recv_waiters_->notify_all();
+    send_seq_.fetch_add(1, std::memory_order_release);
+    recv_seq_.fetch_add(1, std::memory_order_release);
+    fiber::notify_all(&send_seq_);
+    fiber::notify_all(&recv_seq_);
 }
 
 template<typename T>
@@ -184,12 +186,12 @@ template<typename T>
 size_t Channel<T>::size() const {
     size_t h = head_.load(std::memory_order_relaxed);
     size_t t = tail_.load(std::memory_order_relaxed);
-    return t >= h ? (t - h) : (capacity_ - h + t);
+    return t >= h ? (t - h) : 0;
 }
 
 template<typename T>
 size_t Channel<T>::capacity() const {
-    return capacity_ - 1; // -1 because ring buffer needs one empty slot
+    return capacity_;
 }
 
 template<typename T>
@@ -203,11 +205,23 @@ bool Channel<T>::full() const {
 }
 
 // 私有辅助方法
+template<typename T>
+void Channel<T>::wake_sender() {
+    send_seq_.fetch_add(1, std::memory_order_release);
+    fiber::notify_one(&send_seq_);
+}
+
+template<typename T>
+void Channel<T>::wake_receiver() {
+    recv_seq_.fetch_add(1, std::memory_order_release);
+    fiber::notify_one(&recv_seq_);
+}
+
 template<typename T>
 bool Channel<T>::is_full_lockfree() const {
     size_t current_head = head_.load(std::memory_order_acquire);
     size_t current_tail = tail_.load(std::memory_order_acquire);
-    return next_index(current_tail) == current_head;
+    return current_tail - current_head >= capacity_;
 }
 
 template<typename T>
@@ -219,175 +233,118 @@ bool Channel<T>::is_empty_lockfree() const {
 
 template<typename T>
 bool Channel<T>::try_push_lockfree(T &&value) {
-    size_t current_tail = tail_.load(std::memory_order_relaxed);
-    size_t next_tail = next_index(current_tail);
-
-    if (next_tail == head_.load(std::memory_order_acquire)) {
-        return false; // 满了
+    // 多个生产者（包括外部线程）先用CAS抢占tail位置，再写入槽位并发布seq
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+        slot = &buffer_[pos % capacity_];
+        size_t seq = slot->seq.load(std::memory_order_acquire);
+        auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false; // 满了
+        } else {
+            pos = tail_.load(std::memory_order_relaxed);
+        }
     }
 
-    T *new_data = new T(std::move(value));
-    T *expected = nullptr;
-
-    if (buffer_[current_tail].data.compare_exchange_weak(expected, new_data, std::memory_order_release,
-                                                         std::memory_order_relaxed)) {
-
-        tail_.store(next_tail, std::memory_order_release);
-        return true;
-    } else {
-        delete new_data;
-        return false;
-    }
+    slot->data.emplace(std::move(value));
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
 }
 
 template<typename T>
 bool Channel<T>::try_pop_lockfree(T &value) {
-    size_t current_head = head_.load(std::memory_order_relaxed);
-
-    if (current_head == tail_.load(std::memory_order_acquire)) {
-        return false; // 空了
-    }
-
-    T *data = buffer_[current_head].data.exchange(nullptr, std::memory_order_acquire);
-    if (data != nullptr) {
-        value = std::move(*data);
-        delete data;
-        head_.store(next_index(current_head), std::memory_order_release);
-        return true;
+    size_t pos = head_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+        slot = &buffer_[pos % capacity_];
+        size_t seq = slot->seq.load(std::memory_order_acquire);
+        auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+        if (diff == 0) {
+            if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false; // 空了
+        } else {
+            pos = head_.load(std::memory_order_relaxed);
+        }
     }
 
-    return false;
+    value = std::move(*slot->data);
+    slot->data.reset();
+    slot->seq.store(pos + capacity_, std::memory_order_release);
+    return true;
 }
 
 // ==================== 超时方法实现 ====================
 
 template<typename T>
 bool Channel<T>::send_timeout(T value, uint64_t timeout_ms) {
-    // 先尝试非阻塞发送
-    if (try_push_lockfree(std::move(value))) {
-        recv_waiters_->notify_one();
-        return true;
-    }
-
-    // 检查是否已关闭
-    if (state_.load(std::memory_order_acquire) == State::CLOSED) {
-        return false;
-    }
-
-    // 获取当前协程
-    auto current_fiber = Fiber::GetCurrentFiberPtr();
-    if (!current_fiber) {
-        throw std::runtime_error("send_timeout must be called from within a fiber");
-    }
-
-    // 创建超时状态
-    auto timeout_state = std::make_shared<std::atomic<bool>>(false);
-    auto woken_state = std::make_shared<std::atomic<bool>>(false);
-
-    // 添加定时器 - 通过waitqueue唤醒而不是直接调度
-    auto &timer_wheel = TimerWheel::getInstance();
-    auto timer = timer_wheel.addTimer(
-            timeout_ms,
-            [timeout_state, woken_state, waiters = send_waiters_.get()]() {
-                timeout_state->store(true, std::memory_order_release);
-                if (!woken_state->exchange(true, std::memory_order_acq_rel)) {
-                    // 通过waitqueue唤醒
-                    waiters->notify_one();
-                }
-            },
-            false);
-
-    // 进入等待循环
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
     while (true) {
-        send_waiters_->wait();
-
-        // 检查是否超时
-        if (timeout_state->load(std::memory_order_acquire)) {
-            return false;
-        }
+        uint32_t seq = send_seq_.load(std::memory_order_acquire);
 
         // 检查是否已关闭
         if (state_.load(std::memory_order_acquire) == State::CLOSED) {
-            timer_wheel.cancel(timer);
             return false;
         }
 
-        // 尝试发送
         if (try_push_lockfree(std::move(value))) {
-            // 成功了，取消定时器
-            if (!woken_state->exchange(true, std::memory_order_acq_rel)) {
-                timer_wheel.cancel(timer);
-            }
-            recv_waiters_->notify_one();
+            wake_receiver();
             return true;
         }
-    }
-}
 
-template<typename T>
-bool Channel<T>::recv_timeout(T &value, uint64_t timeout_ms) {
-    // 先尝试非阻塞接收
-    if (try_pop_lockfree(value)) {
-        send_waiters_->notify_one();
-        return true;
-    }
-
-    // 检查是否已关闭且为空
-    if (state_.load(std::memory_order_acquire) == State::CLOSED && is_empty_lockfree()) {
-        return false;
-    }
+        auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0) {
+            return false;
+        }
 
-    if (timeout_ms <= 0) {
-        return false; // 超时时间为0或负数
-    }
+        // 获取当前协程
+        if (!Fiber::InSchedulableFiber()) {
+            throw std::runtime_error("send_timeout must be called from within a fiber");
+        }
 
-    // 获取当前协程
-    auto current_fiber = Fiber::GetCurrentFiberPtr();
-    if (!current_fiber) {
-        throw std::runtime_error("recv_timeout must be called from within a fiber");
+        // 超时后回到循环开头再尝试一次
+        FIBER_PROBE1(chan_send_park, this);
+        fiber::wait_on(send_seq_, seq, remaining.count());
+        FIBER_PROBE1(chan_send_unpark, this);
     }
+}
 
-    // 创建超时状态
-    auto timeout_state = std::make_shared<std::atomic<bool>>(false);
-    auto woken_state = std::make_shared<std::atomic<bool>>(false);
-
-    // 添加定时器 - 通过waitqueue唤醒而不是直接调度
-    auto &timer_wheel = TimerWheel::getInstance();
-    auto timer = timer_wheel.addTimer(
-            timeout_ms,
-            [timeout_state, woken_state, waiters = recv_waiters_.get()]() {
-                timeout_state->store(true, std::memory_order_release);
-                if (!woken_state->exchange(true, std::memory_order_acq_rel)) {
-                    // 通过waitqueue唤醒
-                    waiters->notify_one();
-                }
-            },
-            false);
-
-    // 进入等待循环
+template<typename T>
+bool Channel<T>::recv_timeout(T &value, uint64_t timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
     while (true) {
-        recv_waiters_->wait();
+        uint32_t seq = recv_seq_.load(std::memory_order_acquire);
 
-        // 检查是否超时
-        if (timeout_state->load(std::memory_order_acquire)) {
-            return false;
-        }
-
-        // 尝试接收
         if (try_pop_lockfree(value)) {
-            // 成功了，取消定时器
-            if (!woken_state->exchange(true, std::memory_order_acq_rel)) {
-                timer_wheel.cancel(timer);
-            }
-            send_waiters_->notify_one();
+            wake_sender();
             return true;
         }
 
         // 检查是否已关闭且为空
         if (state_.load(std::memory_order_acquire) == State::CLOSED && is_empty_lockfree()) {
-            timer_wheel.cancel(timer);
             return false;
         }
+
+        auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0) {
+            return false;
+        }
+
+        // 获取当前协程
+        if (!Fiber::InSchedulableFiber()) {
+            throw std::runtime_error("recv_timeout must be called from within a fiber");
+        }
+
+        FIBER_PROBE1(chan_recv_park, this);
+        fiber::wait_on(recv_seq_, seq, remaining.count());
+        FIBER_PROBE1(chan_recv_unpark, this);
     }
 }
 
@@ -0,0 +1,110 @@
+//
+// Created by inory on 12/21/25.
+//
+
+#ifndef FIBER_CONTENTION_H
+#define FIBER_CONTENTION_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace fiber::contention {
+
+/**
+ * 锁竞争profiler（类似Go的mutex profile）
+ *
+ * 开启后，FiberMutex每rate次有竞争的加锁采样一次，记录等待时间、这次持有锁的时间，
+ * 按锁实例和加锁调用点（lock()的返回地址）汇总；次数和时间都乘以rate，近似全部竞争的总量。
+ * 没有竞争的加锁不采样，关闭时慢速路径只多一次原子读，快速路径不受影响。典型用法：
+ *   contention::start(10);
+ *   ...                                        // 跑负载
+ *   contention::stop();
+ *   contention::write_report(std::cout, 20);   // 按等待时间从多到少
+ *
+ * 其他同步原语接入时，在竞争路径上调用sample()决定是否采样，
+ * 拿到锁后调用record_wait，释放时调用record_hold，见FiberMutex
+ */
+
+/**
+ * @brief 一个（锁实例，调用点）的汇总
+ */
+struct Record {
+    const void *lock{nullptr};
+    uintptr_t site{0}; // 加锁调用点的返回地址
+    uint64_t contentions{0}; // 有竞争的加锁次数
+    std::chrono::nanoseconds wait{0}; // 等待锁的总时间
+    std::chrono::nanoseconds hold{0}; // 这些加锁持有锁的总时间
+};
+
+namespace detail {
+extern std::atomic<uint32_t> rate;
+} // namespace detail
+
+/**
+ * @brief 开始记录
+ * @param rate 每rate次竞争采样一次，1表示全部记录
+ * @return 已经在运行时返回false
+ */
+bool start(uint32_t rate = 1);
+
+/**
+ * @brief 停止记录，已有的数据保留到reset
+ */
+void stop();
+
+bool running();
+
+void reset();
+
+/**
+ * @brief 当前的汇总记录，按等待时间从多到少
+ */
+std::vector<Record> snapshot();
+
+/**
+ * @brief 输出文本报告，每行一个（锁实例，调用点），max_entries为0时输出全部
+ */
+void write_report(std::ostream &out, size_t max_entries = 0);
+
+// ==================== 同步原语使用 ====================
+
+/**
+ * @brief 竞争路径上调用：本次竞争是否需要采样
+ */
+inline bool sample() {
+    const uint32_t rate = detail::rate.load(std::memory_order_relaxed);
+    if (rate == 0) {
+        return false;
+    }
+    if (rate == 1) {
+        return true;
+    }
+    static thread_local uint32_t countdown = 0;
+    if (countdown == 0) {
+        countdown = rate;
+    }
+    return --countdown == 0;
+}
+
+inline int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+}
+
+/**
+ * @brief 采样的加锁在拿到锁后调用
+ */
+void record_wait(const void *lock, const void *site, std::chrono::nanoseconds wait);
+
+/**
+ * @brief 采样的加锁在释放锁后调用
+ */
+void record_hold(const void *lock, const void *site, std::chrono::nanoseconds hold);
+
+} // namespace fiber::contention
+
+#endif // FIBER_CONTENTION_H
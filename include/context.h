@@ -34,6 +34,36 @@ protected:
     void *stack_;
 };
 
+/**
+ * @brief 栈分配选项，由调度器在启动时设置
+ */
+struct StackOptions {
+    bool huge_pages = false; // 从2MB大页区域中切分栈，切换大量fiber时减少TLB miss
+    size_t prefault_bytes = 0; // 新栈分配时预先触碰栈顶的字节数
+    bool populate = false; // 使用MAP_POPULATE一次性建立页表，适合延迟敏感的场景
+};
+
+/**
+ * @brief 协程栈池
+ *
+ * 每个线程缓存一批默认大小的栈：fiber首次resume时取栈，运行结束立即归还，
+ * 峰值内存跟随同时运行中的fiber数量，而不是排队中的fiber数量
+ */
+class StackPool {
+public:
+    static void *acquire(size_t size);
+    static void release(void *stack, size_t size);
+
+    /**
+     * @brief 设置栈分配选项，必须在分配第一个栈之前调用，否则忽略
+     */
+    static void configure(const StackOptions &options);
+    static const StackOptions &options();
+
+private:
+    static constexpr size_t kMaxCachedStacks = 64; // 每线程最多缓存的栈数量
+};
+
 /**
  * UContext
  */
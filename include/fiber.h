@@ -4,7 +4,10 @@
 #include <chrono>
 #include <functional>
 #include <memory>
+#include <optional>
+#include <stdexcept>
 #include <thread>
+#include <vector>
 
 #include "context.h"
 #include "serika/basic/logger.h"
@@ -14,16 +17,30 @@ namespace fiber {
 class Context;
 class Scheduler;
 class AsmContext;
+class FiberConsumer;
 
 enum class FiberState { READY, RUNNING, SUSPENDED, BLOCKED, DONE };
 
+/**
+ * @brief fiber的deadline已过，在挂起点被取消
+ *
+ * 由Fiber::yield、WaitQueue::wait、Fiber::sleep等挂起点抛出，fiber入口会吞掉该异常并结束fiber
+ */
+class DeadlineExceeded : public std::runtime_error {
+public:
+    DeadlineExceeded() : std::runtime_error("fiber deadline exceeded") {}
+};
+
 // must be public inheritance
 class Fiber : public std::enable_shared_from_this<Fiber> {
 public:
     friend class Scheduler;
     friend class AsmContext;
+    friend class FiberConsumer;
     using ptr = std::shared_ptr<Fiber>;
     using FiberFunction = std::function<void()>;
+    using Clock = std::chrono::steady_clock;
+    using TimePoint = Clock::time_point;
 
     enum class RunMode {
         MANUAL, // Lua语义：手动控制
@@ -73,6 +90,45 @@ public:
      */
     static void go(FiberFunction func, uint64_t feature_id = 0, size_t stack_size = UContext::DEFAULT_STACK_SIZE);
 
+    /**
+     * 批量创建goroutine，整批只做一次入队操作
+     * 适合一次扇出成千上万个子任务的场景
+     * @param funcs 要执行的函数
+     * @param feature_id 特征数
+     * @param stack_size 栈大小
+     */
+    static void go_batch(std::vector<FiberFunction> funcs, uint64_t feature_id = 0,
+                         size_t stack_size = UContext::DEFAULT_STACK_SIZE);
+
+    /**
+     * 创建根goroutine（一次新请求的入口），受调度器准入控制约束
+     * 不在fiber中调用Fiber::go创建的fiber同样视为根fiber
+     * @param func 要执行的函数
+     * @param feature_id 特征数
+     * @param stack_size 栈大小
+     * @return false表示调度器过载，fiber被拒绝（不会执行，已通知shed回调）
+     */
+    static bool go_root(FiberFunction func, uint64_t feature_id = 0, size_t stack_size = UContext::DEFAULT_STACK_SIZE);
+
+    /**
+     * 在指定consumer上创建goroutine，fiber绑定该consumer，不会被窃取
+     * 用于需要在特定线程上执行的操作（设置线程信号掩码、访问consumer本地资源）
+     * @param consumer_id consumer编号，[0, getWorkerCount())
+     * @param func 要执行的函数
+     * @param stack_size 栈大小
+     */
+    static void go_on(uint64_t consumer_id, FiberFunction func, size_t stack_size = UContext::DEFAULT_STACK_SIZE);
+
+    /**
+     * 创建库内部的常驻goroutine（后台回收、信号分发、日志刷新等）
+     * 不继承调用方的deadline和标签，也不受准入控制，即使是在某个请求的fiber里第一次被拉起
+     * @param func 要执行的函数
+     * @param consumer_id 绑定的consumer编号，-1表示不绑定
+     * @param stack_size 栈大小
+     */
+    static void go_system(FiberFunction func, int64_t consumer_id = -1,
+                          size_t stack_size = UContext::DEFAULT_STACK_SIZE);
+
     /**
      * 获取工作线程数量
      */
@@ -84,12 +140,25 @@ public:
      */
     static void sleep(uint64_t ms);
 
+    /**
+     * @brief 协程休眠（微秒）
+     * @param us 休眠时间（微秒）
+     *
+     * 开启fiber.timer.high_resolution时由HighResTimer定时，否则向上取整到毫秒后走sleep
+     */
+    static void sleep_us(uint64_t us);
+
     /**
      * @brief 获取当前协程的shared_ptr（用于WaitQueue等同步机制）
      * @return 当前协程的shared_ptr，如果不在协程中则返回nullptr
      */
     static ptr GetCurrentFiberPtr();
 
+    /**
+     * @brief 获取当前协程的裸指针，不增加引用计数（profiler的信号处理函数使用）
+     */
+    static Fiber *GetCurrentFiberRaw() { return current_fiber_; }
+
     /**
      * @brief 设置当前协程的weak_ptr（供调度器调用）
      * @param fiber 当前协程的shared_ptr
@@ -98,6 +167,13 @@ public:
 
     static void ResetMainFiber();
 
+    /**
+     * @brief 当前是否运行在可挂起的fiber中
+     *
+     * 外部线程、以及consumer线程的调度循环本身（定时器回调、IO回调）返回false
+     */
+    static bool InSchedulableFiber();
+
     void SetConsumerId(uint64_t cos_id);
 
     std::optional<uint64_t> GetConsumerId() const;
@@ -106,6 +182,45 @@ public:
 
     uint64_t GetTraceId() const;
 
+    /**
+     * @brief 设置CPU时间统计的标签（例如租户id），之后通过Fiber::go创建的子fiber会继承
+     *
+     * 开启accounting时按标签汇总CPU时间，标签为0时按trace id汇总，见accounting.h
+     */
+    void SetTag(uint64_t tag) { tag_ = tag; }
+
+    uint64_t GetTag() const { return tag_; }
+
+    // 开启accounting以来该fiber在CPU上运行的周期数，用accounting::to_duration换算成时间
+    uint64_t GetCpuCycles() const { return cpu_cycles_; }
+
+    // =========================
+    // Deadline (EDF调度)
+    // =========================
+
+    /**
+     * @brief 设置绝对deadline，之后通过Fiber::go创建的子fiber会继承（go_system除外）
+     *
+     * 带deadline的fiber在consumer上按最早deadline优先调度；
+     * deadline已过后fiber在下一个挂起点抛出DeadlineExceeded。尚未开始运行的fiber同样会被执行，
+     * 而不是直接丢弃，这样函数体里的RAII和WaitGroup::done()等收尾逻辑总能随异常展开执行
+     */
+    void SetDeadline(TimePoint deadline);
+
+    void ClearDeadline();
+
+    std::optional<TimePoint> GetDeadline() const;
+
+    bool IsDeadlineExceeded() const;
+
+    // 是否为根fiber（请求入口），准入控制只拒绝根fiber
+    bool IsRoot() const { return root_; }
+
+    /**
+     * @brief 挂起点调用：当前fiber的deadline已过时抛出DeadlineExceeded
+     */
+    static void CheckDeadline();
+
     ~Fiber();
 
 private:
@@ -117,6 +232,8 @@ private:
     Fiber &operator=(Fiber &&) = delete;
 
     void Init(size_t stack_size = UContext::DEFAULT_STACK_SIZE);
+    void inheritFrom(const Fiber *parent);
+    void discard();
     static void fiberEntry();
     static void yield_internal(Fiber *current);
 
@@ -127,10 +244,16 @@ private:
 
     uint64_t id_;
     uint64_t trace_id_ = 0;
+    uint64_t tag_ = 0;
+    uint64_t cpu_cycles_ = 0;
+    size_t stack_size_ = UContext::DEFAULT_STACK_SIZE;
+    std::optional<TimePoint> deadline_;
+    TimePoint enqueue_time_{}; // 最近一次进入consumer队列的时间，准入控制开启时才记录
+    bool root_ = false;
     std::optional<uint64_t> consumer_id_;
     FiberState state_;
     FiberFunction func_;
-    std::unique_ptr<Context> context_;
+    std::unique_ptr<Context> context_; // 非main fiber在首次resume时才创建，结束后立即释放
     RunMode run_mode_;
     Fiber::ptr parent_fiber_;
 
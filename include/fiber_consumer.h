@@ -2,14 +2,21 @@
 #define FIBER_CONSUMER_H
 
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <memory>
+#include <queue>
 #include <thread>
+#include <vector>
 // #include "concurrentqueue.h"
 #include "fiber.h"
 #include "lockfree/lockfree_linked_list.h"
+#include "lockfree/steal_deque.h"
 
 namespace fiber {
 class TimerWheel;
+class HighResTimer;
+class BufferRing;
 }
 namespace fiber {
 class IOManager;
@@ -38,11 +45,28 @@ public:
     void start();
     void stop();
     bool schedule(Fiber::ptr fiber);
+    // 投递尚未绑定consumer的新fiber，这部分fiber可以被空闲consumer窃取
+    bool spawn(Fiber::ptr fiber);
+    bool spawnBatch(std::vector<Fiber::ptr> &fibers);
     size_t getQueueSize() const;
+    // 供其他consumer窃取新spawn的fiber
     auto popTask() -> std::optional<Fiber::ptr>;
+    // 准入控制：排队时延持续超过目标值时为true，可被任意线程读取
+    bool isOverloaded() const { return overloaded_.load(std::memory_order_relaxed); }
+    // 忙轮询：没有活干时先在window内反复零超时epoll_wait并检查运行队列，超过window才阻塞等待。
+    // 用独占的CPU换取唤醒时延，0表示关闭，可被任意线程设置
+    void setBusyPoll(std::chrono::microseconds window);
+    bool isBusyPolling() const { return busy_poll_us_.load(std::memory_order_relaxed) > 0; }
+
+    // 当前线程所运行的consumer，非consumer线程返回nullptr
+    static FiberConsumer *current();
 
 private:
     static constexpr size_t QUEUE_SIZE = 1024; // 队列容量
+    static constexpr size_t kStealBatch = 16; // 单次最多窃取的fiber数
+    static constexpr size_t kStealThreshold = 1; // 被窃取方至少保留的fiber数
+    static constexpr size_t kRefillBatch = 32; // 每次从无锁队列搬到本地就绪队列的最大数量
+    static constexpr size_t kEdfStreak = 8; // 连续调度带deadline的fiber后，让无deadline的fiber跑一次
     int id_;
 
     Scheduler *scheduler_;
@@ -50,13 +74,47 @@ private:
     std::atomic<bool> running_{false};
 
     // 使用lock-free队列存储Fiber::ptr
+    // 运行队列是跨consumer投递的入口，thread-per-core模式下也保持线程安全
     std::unique_ptr<LockFreeLinkedList<Fiber::ptr>> queue_;
+    // 新spawn、尚未运行过的fiber，不绑定consumer，可被窃取；只有本consumer线程push
+    std::unique_ptr<StealDeque<Fiber::ptr>> spawn_queue_;
+    // 其他线程spawn到本consumer的fiber先进这里，由本consumer搬进spawn_queue_
+    std::unique_ptr<LockFreeLinkedList<Fiber::ptr>> spawn_inbox_;
+    bool prefer_spawn_{false}; // 两个队列轮流取，避免反复yield的fiber饿死新fiber
+
+    // 本地就绪队列（仅consumer线程访问）：带deadline的fiber按EDF排序，其余FIFO
+    struct DeadlineLater {
+        bool operator()(const Fiber::ptr &a, const Fiber::ptr &b) const { return *a->GetDeadline() > *b->GetDeadline(); }
+    };
+    std::priority_queue<Fiber::ptr, std::vector<Fiber::ptr>, DeadlineLater> edf_queue_;
+    std::deque<Fiber::ptr> fifo_queue_;
+    size_t edf_streak_{0};
+
+    // CoDel状态（仅consumer线程写）：first_above_time_是排队时延首次超过目标值后再过一个interval的时刻
+    Fiber::TimePoint first_above_time_{};
+    std::atomic<bool> overloaded_{false};
+    std::atomic<int64_t> busy_poll_us_{0}; // 忙轮询窗口（微秒）
+    std::atomic<bool> idle_{false}; // 正阻塞在epoll_wait里，本地spawn积压时由其他consumer唤醒来窃取
     // std::unique_ptr<moodycamel::ConcurrentQueue<Fiber::ptr>> queue_;
     std::unique_ptr<IOManager> io_manager_;
     std::unique_ptr<TimerWheel> timer_wheel_;
+    std::unique_ptr<HighResTimer> hires_timer_; // 开启fiber.timer.high_resolution时才创建
+    std::unique_ptr<BufferRing> buffer_ring_; // 第一次IO::read_any时创建
+
+    static thread_local FiberConsumer *current_;
 
     void consumerLoop();
     void processTask();
+    Fiber::ptr nextTask();
+    void refillReady();
+    bool stealTasks();
+    bool peersHaveStealable() const;
+    void wakeIdlePeer();
+    bool busyPoll();
+    void stampEnqueue(const Fiber::ptr &fiber) const;
+    void observeSojourn(const Fiber::ptr &fiber);
+    void resetSojourn();
+    bool isLocal() const { return current_ == this; }
 };
 
 } // namespace fiber
@@ -0,0 +1,203 @@
+//
+// Created by inory on 12/23/25.
+//
+
+#ifndef FIBER_LOG_H
+#define FIBER_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <unistd.h>
+
+/**
+ * 按consumer缓冲的异步日志
+ *
+ * serika的LOG_*在consumer线程上同步格式化、同步写出，放在addEvent这类每次阻塞IO都会经过的路径上时，
+ * 写日志本身就会卡住事件循环。FIBER_LOG_*在consumer线程上只把格式化后的一行放进该consumer独占的无锁环，
+ * 由一个专门的flusher fiber定期（或环过半时被唤醒）把所有环里的记录攒成一批，用IO::writev一次写出。
+ * 环满时丢弃新记录并计数，绝不阻塞；外部线程、以及start之前的日志直接同步写出。
+ *   log::start({.fd = log_fd, .level = log::Level::Info});
+ *   FIBER_LOG_INFO("accepted fd={} from {}", fd, peer);
+ *   ...
+ *   log::stop();                                        // 写出剩余的记录
+ *
+ * 级别过滤有两层：低于FIBER_LOG_MIN_LEVEL（编译期，0-3对应Debug-Error，默认NDEBUG时为1）的宏展开为空，
+ * 参数不会求值；低于运行时级别（log::set_level）的只多一次原子读。
+ * 格式串只支持"{}"占位符（"{{"、"}}"转义），参数支持整数、浮点、bool、char、字符串、指针和枚举，
+ * 单行超过Record容量时截断。
+ * sink通过/proc/self/fd重新打开Options::fd，IO::writev设置的非阻塞只作用在自己的那份上，不影响调用方的fd（例如stderr）；
+ * 无法重新打开的fd（socket等）只做同步阻塞写，会阻塞flusher所在的consumer
+ */
+
+#ifndef FIBER_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define FIBER_LOG_MIN_LEVEL 1
+#else
+#define FIBER_LOG_MIN_LEVEL 0
+#endif
+#endif
+
+namespace fiber::log {
+
+enum class Level : uint8_t { Debug = 0, Info = 1, Warn = 2, Error = 3, Off = 4 };
+
+struct Options {
+    int fd = STDERR_FILENO; // 写出的目标
+    size_t records_per_consumer = 1024; // 每个consumer环的容量（向上取整到2的幂），只在第一次start时生效
+    std::chrono::milliseconds flush_interval{10}; // flusher没有被唤醒时的最长间隔
+    int flusher_consumer = -1; // flusher所在的consumer，-1表示最后一个
+    Level level = Level::Info; // 运行时级别
+};
+
+namespace detail {
+
+extern std::atomic<uint8_t> level;
+
+// 类型擦除后的格式化参数，只引用调用方的数据，不拷贝
+struct Arg {
+    enum class Type : uint8_t { None, Int, Uint, Double, Bool, Char, String, Pointer };
+
+    Type type{Type::None};
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        bool b;
+        char c;
+        const void *p;
+        struct {
+            const char *data;
+            size_t size;
+        } s;
+    };
+
+    Arg() : u(0) {}
+
+    template<typename T>
+    Arg(const T &value) {
+        using U = std::decay_t<T>;
+        if constexpr (std::is_same_v<U, bool>) {
+            type = Type::Bool;
+            b = value;
+        } else if constexpr (std::is_same_v<U, char>) {
+            type = Type::Char;
+            c = value;
+        } else if constexpr (std::is_enum_v<U>) {
+            type = Type::Int;
+            i = static_cast<int64_t>(value);
+        } else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>) {
+            type = Type::Int;
+            i = value;
+        } else if constexpr (std::is_integral_v<U>) {
+            type = Type::Uint;
+            u = value;
+        } else if constexpr (std::is_floating_point_v<U>) {
+            type = Type::Double;
+            d = value;
+        } else if constexpr (std::is_same_v<U, const char *> || std::is_same_v<U, char *>) {
+            const char *str = value ? value : "(null)";
+            std::string_view view(str);
+            type = Type::String;
+            s = {view.data(), view.size()};
+        } else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+            std::string_view view = value;
+            type = Type::String;
+            s = {view.data(), view.size()};
+        } else if constexpr (std::is_pointer_v<U>) {
+            type = Type::Pointer;
+            p = value;
+        } else {
+            static_assert(std::is_pointer_v<U>, "unsupported FIBER_LOG argument type");
+        }
+    }
+};
+
+// 按fmt把args格式化到out，最多写cap字节，返回写入的长度
+size_t format(char *out, size_t cap, std::string_view fmt, const Arg *args, size_t count);
+
+void write(Level level, std::string_view fmt, const Arg *args, size_t count);
+
+} // namespace detail
+
+/**
+ * @brief 启动flusher，需要调度器已经在运行
+ * @return 已经在运行时返回false
+ */
+bool start(const Options &options = {});
+
+/**
+ * @brief 停止flusher并同步写出所有已缓冲的记录
+ */
+void stop();
+
+bool running();
+
+/**
+ * @brief 同步写出所有已缓冲的记录，可以在任意线程调用
+ */
+void flush();
+
+void set_level(Level level);
+
+Level level();
+
+inline bool enabled(Level level) {
+    return static_cast<uint8_t>(level) >= detail::level.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief 因为环满而丢弃的记录总数
+ */
+uint64_t dropped();
+
+template<typename... Args>
+void write(Level level, std::string_view fmt, const Args &...args) {
+    const detail::Arg packed[sizeof...(Args) + 1] = {detail::Arg(args)...};
+    detail::write(level, fmt, packed, sizeof...(Args));
+}
+
+// ==================== 调度器使用 ====================
+
+/**
+ * @brief 调度器启动consumer前调用，分配每个consumer的环
+ */
+void attachConsumers(int count);
+
+} // namespace fiber::log
+
+#define FIBER_LOG_AT(level, ...)                                                                                       \
+    do {                                                                                                               \
+        if (::fiber::log::enabled(level)) {                                                                            \
+            ::fiber::log::write(level, __VA_ARGS__);                                                                   \
+        }                                                                                                              \
+    } while (0)
+
+#if FIBER_LOG_MIN_LEVEL <= 0
+#define FIBER_LOG_DEBUG(...) FIBER_LOG_AT(::fiber::log::Level::Debug, __VA_ARGS__)
+#else
+#define FIBER_LOG_DEBUG(...) ((void) 0)
+#endif
+
+#if FIBER_LOG_MIN_LEVEL <= 1
+#define FIBER_LOG_INFO(...) FIBER_LOG_AT(::fiber::log::Level::Info, __VA_ARGS__)
+#else
+#define FIBER_LOG_INFO(...) ((void) 0)
+#endif
+
+#if FIBER_LOG_MIN_LEVEL <= 2
+#define FIBER_LOG_WARN(...) FIBER_LOG_AT(::fiber::log::Level::Warn, __VA_ARGS__)
+#else
+#define FIBER_LOG_WARN(...) ((void) 0)
+#endif
+
+#if FIBER_LOG_MIN_LEVEL <= 3
+#define FIBER_LOG_ERROR(...) FIBER_LOG_AT(::fiber::log::Level::Error, __VA_ARGS__)
+#else
+#define FIBER_LOG_ERROR(...) ((void) 0)
+#endif
+
+#endif // FIBER_LOG_H
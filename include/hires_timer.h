@@ -0,0 +1,96 @@
+//
+// Created by inory on 12/17/25.
+//
+
+#ifndef FIBER_HIRES_TIMER_H
+#define FIBER_HIRES_TIMER_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+namespace fiber {
+class FiberConsumer;
+class IOManager;
+}
+namespace fiber {
+
+/**
+ * @brief 高精度定时器（每个consumer一个，需开启fiber.timer.high_resolution）
+ *
+ * TimerWheel的精度受tick间隔和毫秒级epoll_wait超时限制，不适合限速发包、对冲请求这类亚毫秒的deadline。
+ * HighResTimer用最小堆保存纳秒精度的到期时间：
+ * 1. 内核支持epoll_pwait2时，调度循环直接用纳秒超时等待到最早的到期时间
+ * 2. 否则把最早的到期时间编程到timerfd上，timerfd注册在本consumer的IOManager里
+ * 两种方式都不忙等。回调在consumer调度循环中执行，不能阻塞。
+ * 注意：只能在所属consumer线程上（fiber中）添加和取消
+ */
+class HighResTimer {
+public:
+    using Clock = std::chrono::steady_clock;
+    using TimePoint = Clock::time_point;
+    using Callback = std::function<void()>;
+    using TimerId = uint64_t;
+
+    friend FiberConsumer;
+
+    ~HighResTimer();
+
+    HighResTimer(const HighResTimer &) = delete;
+    HighResTimer &operator=(const HighResTimer &) = delete;
+
+    /**
+     * @brief 在deadline时刻执行回调
+     * @return 定时器id，用于取消
+     */
+    TimerId addAt(TimePoint deadline, Callback cb);
+
+    /**
+     * @brief delay之后执行回调
+     */
+    TimerId addAfter(std::chrono::nanoseconds delay, Callback cb) { return addAt(Clock::now() + delay, std::move(cb)); }
+
+    /**
+     * @brief 取消定时器，已经触发的定时器忽略
+     */
+    void cancel(TimerId id);
+
+    /**
+     * @brief 尚未触发的定时器数量
+     */
+    size_t size() const { return callbacks_.size(); }
+
+private:
+    HighResTimer(IOManager &io_manager, bool use_timerfd);
+
+    struct Entry {
+        TimePoint deadline;
+        TimerId id;
+    };
+    struct Later {
+        bool operator()(const Entry &a, const Entry &b) const { return a.deadline > b.deadline; }
+    };
+
+    // 供调度循环调用：等待时间不超过max，有更早的到期时间时缩短
+    std::chrono::nanoseconds waitTimeout(std::chrono::nanoseconds max);
+    // 执行所有已到期的回调
+    void expire();
+    // 跳过堆顶已取消的条目后返回最早的到期时间
+    bool nextDeadline(TimePoint &deadline);
+    // 把最早的到期时间编程到timerfd上
+    void program();
+
+    IOManager &io_manager_;
+    int timer_fd_{-1}; // 仅在不支持epoll_pwait2时使用
+    TimePoint armed_{TimePoint::max()}; // timerfd当前编程的到期时间
+    TimerId next_id_{1};
+    std::priority_queue<Entry, std::vector<Entry>, Later> heap_;
+    std::unordered_map<TimerId, Callback> callbacks_; // 取消即从这里删除，堆中的条目惰性跳过
+};
+
+} // namespace fiber
+
+#endif // FIBER_HIRES_TIMER_H
@@ -2,8 +2,11 @@
 
 #include <chrono>
 #include <optional>
+#include <poll.h>
+#include <span>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include "buffer_ring.h"
 #include "io_manager.h"
 #include "timer.h"
 
@@ -34,14 +37,45 @@ public:
 
     static std::optional<ssize_t> recv_et(int fd, void *buffer, size_t len, int flags, int64_t timeout_ms = -1);
 
+    // Read without a caller-owned buffer: the buffer comes from the consumer's BufferRing and is only
+    // taken when data arrives (io_uring provided buffers, or epoll readiness plus a pooled buffer on
+    // kernels without them), so idle connections hold no read memory.
+    // Returns up to BufferRing::bufferSize() bytes, an empty buffer on EOF, or nullopt with errno set
+    static std::optional<IOBuffer> read_any(int fd, int64_t timeout_ms = -1);
+
     // Close fd and clean up all IOManager state
     static int close(int fd);
 
     static int shutdown(int fd, int how);
 
+    // Readiness-only waits, for third-party non-blocking libraries (c-ares, librdkafka, libpq)
+    // that drive their own fds. The fiber parks on the consumer's epoll instead of a dedicated thread.
+    // Outside a fiber these fall back to a blocking ::poll.
+
+    // Wait until fd is ready for any of events (POLLIN / POLLOUT / POLLPRI / POLLRDHUP).
+    // Returns revents; nullopt with errno=ETIMEDOUT on timeout, or errno from poll/epoll on failure
+    static std::optional<short> wait(int fd, short events, int64_t timeout_ms = -1);
+
+    static bool wait_readable(int fd, int64_t timeout_ms = -1) { return wait(fd, POLLIN, timeout_ms).has_value(); }
+
+    static bool wait_writable(int fd, int64_t timeout_ms = -1) { return wait(fd, POLLOUT, timeout_ms).has_value(); }
+
+    // Wait until any fd in fds is ready, filling revents like ::poll. Entries with fd < 0 are ignored.
+    // Returns the number of ready entries; nullopt with errno=ETIMEDOUT on timeout (timeout_ms == 0 never parks)
+    static std::optional<int> poll(std::span<pollfd> fds, int64_t timeout_ms = -1);
+
+    // Set SO_BUSY_POLL (and SO_PREFER_BUSY_POLL where available) so the kernel polls the NIC queue
+    // for up to busy_poll_us when the socket is read or epoll'ed. Raising it needs CAP_NET_ADMIN.
+    // accept/accept_et/connect apply fiber.busy_poll.socket_us automatically on busy-polling consumers
+    static bool set_busy_poll(int fd, int busy_poll_us);
+
 private:
     template<typename Func>
     static std::optional<ssize_t> doIO(int fd, IOEvent event, Func &&op, bool use_et, int64_t timeout_ms);
+
+    static int64_t capTimeoutToDeadline(const Fiber *fiber, int64_t timeout_ms);
+
+    static void applyBusyPoll(int fd);
 };
 
 } // namespace fiber
@@ -1,10 +1,13 @@
 #pragma once
 
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <map>
 #include <memory>
 #include <sys/epoll.h>
+#include <unordered_map>
 #include <unordered_set>
 #include "fiber.h"
 #include "wait_queue.h"
@@ -27,6 +30,14 @@ public:
         std::unique_ptr<WaitQueue> read_waiters;
         std::unique_ptr<WaitQueue> write_waiters;
         uint32_t events{0};
+        // 每个事件位上登记的等待者数（下标是位序号），一个fd可以被doIO和多个IO::poll同时等待，
+        // 某一位的最后一个等待者离开时才从epoll注册里去掉，全部离开时才删除上下文
+        std::array<uint32_t, 32> waiter_counts{};
+
+        void retain(uint32_t mask);
+        // 返回去掉mask中各位的一个等待者后仍需要注册的事件
+        uint32_t remainingAfter(uint32_t mask) const;
+        void release(uint32_t mask);
     };
 
     using IOCallback = std::function<void()>;
@@ -41,20 +52,35 @@ public:
 
     void wakeUpEpoll();
     bool addEvent(int fd, IOEvent event, bool use_et);
+    // 撤销一次addEvent/addWaiter的登记，同一个fd上其他等待者的事件不受影响
     bool delEvent(int fd, IOEvent event, bool use_et);
+    // 只等待就绪、不绑定具体IO操作：把凭据挂到fd的读/写等待队列上（电平触发 + ONESHOT）
+    bool addWaiter(int fd, IOEvent event, const WaitQueue::WaitTicket &ticket);
     bool wakeUp(int fd, IOEvent event);
     auto getFdContext(int fd) const -> FdContextPtr;
 
-    void processEvents(int timeout_ms);
+    // 常驻监听（电平触发、非ONESHOT）：fd就绪时在调度循环里直接执行cb，cb不能阻塞。
+    // 供timerfd、signalfd这类由consumer自己消费的fd使用，不能和addEvent/addWaiter混用同一个fd
+    bool addWatch(int fd, uint32_t events, IOCallback cb);
+    bool removeWatch(int fd);
+
+    // 返回处理的就绪事件数，出错返回0
+    int processEvents(int timeout_ms);
+    // 纳秒精度的超时，内核支持epoll_pwait2时不会被取整到毫秒
+    int processEvents(std::chrono::nanoseconds timeout);
+    bool supportsPreciseWait() const { return precise_wait_; }
 
 private:
     IOManager();
 
     bool handleFd(int fd, uint32_t revents);
+    void handleEvents(const epoll_event *events, int n);
 
     int epoll_fd_ {-1};
     int wakeup_fd_ {-1};     // eventfd，用于唤醒 epoll_wait
+    bool precise_wait_{false}; // 内核是否支持epoll_pwait2
     std::map<int, FdContextPtr> fd_contexts_;
+    std::unordered_map<int, IOCallback> watches_;
     std::atomic<bool> running_{false};
 
     FdContextPtr getOrCreateFdContext(int fd);
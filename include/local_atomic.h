@@ -0,0 +1,103 @@
+//
+// Created by inory on 12/02/25.
+//
+
+#ifndef FIBER_LOCAL_ATOMIC_H
+#define FIBER_LOCAL_ATOMIC_H
+
+#include <atomic>
+#include <type_traits>
+
+/*
+ * 线程模型配置
+ *
+ * 默认是共享模型：同步原语、定时器、等待队列可以被任意consumer线程访问，内部全部使用原子操作。
+ * 定义 FIBER_THREAD_PER_CORE 后切换为 thread-per-core（Seastar）模型：
+ *   - 每个consumer独占自己的定时器、IO等待队列和同步原语，不允许跨consumer共享
+ *   - 本地路径退化为普通读写，不再有lock前缀指令和缓存行乒乓
+ *   - 在consumer线程上创建的fiber固定留在该consumer上，不做work stealing
+ *   - 只有显式的跨分片接口（Scheduler::scheduleImmediate -> consumer运行队列）保留原子操作
+ */
+
+namespace fiber {
+
+#ifdef FIBER_THREAD_PER_CORE
+inline constexpr bool kLocalThreadSafe = false;
+#else
+inline constexpr bool kLocalThreadSafe = true;
+#endif
+
+/**
+ * @brief 单线程所有权下的"原子"变量
+ *
+ * 接口与std::atomic保持一致，便于通过LocalAtomic在两种模型间切换；
+ * 内存序参数全部忽略，所有操作都是普通读写
+ */
+template<typename T>
+class PlainAtomic {
+public:
+    constexpr PlainAtomic() noexcept = default;
+    constexpr PlainAtomic(T value) noexcept : value_(value) {}
+
+    PlainAtomic(const PlainAtomic &) = delete;
+    PlainAtomic &operator=(const PlainAtomic &) = delete;
+
+    T load(std::memory_order = std::memory_order_seq_cst) const noexcept { return value_; }
+
+    void store(T value, std::memory_order = std::memory_order_seq_cst) noexcept { value_ = value; }
+
+    T exchange(T value, std::memory_order = std::memory_order_seq_cst) noexcept {
+        T old = value_;
+        value_ = value;
+        return old;
+    }
+
+    bool compare_exchange_strong(T &expected, T desired, std::memory_order = std::memory_order_seq_cst,
+                                 std::memory_order = std::memory_order_seq_cst) noexcept {
+        if (value_ == expected) {
+            value_ = desired;
+            return true;
+        }
+        expected = value_;
+        return false;
+    }
+
+    bool compare_exchange_weak(T &expected, T desired, std::memory_order success = std::memory_order_seq_cst,
+                               std::memory_order failure = std::memory_order_seq_cst) noexcept {
+        return compare_exchange_strong(expected, desired, success, failure);
+    }
+
+    T fetch_add(T delta, std::memory_order = std::memory_order_seq_cst) noexcept {
+        T old = value_;
+        value_ = old + delta;
+        return old;
+    }
+
+    T fetch_sub(T delta, std::memory_order = std::memory_order_seq_cst) noexcept {
+        T old = value_;
+        value_ = old - delta;
+        return old;
+    }
+
+    operator T() const noexcept { return value_; }
+
+    PlainAtomic &operator=(T value) noexcept {
+        value_ = value;
+        return *this;
+    }
+
+private:
+    T value_{};
+};
+
+/**
+ * @brief 本地路径使用的原子类型
+ *
+ * 共享模型下就是std::atomic<T>，thread-per-core模型下是PlainAtomic<T>
+ */
+template<typename T, bool ThreadSafe = kLocalThreadSafe>
+using LocalAtomic = std::conditional_t<ThreadSafe, std::atomic<T>, PlainAtomic<T>>;
+
+} // namespace fiber
+
+#endif // FIBER_LOCAL_ATOMIC_H
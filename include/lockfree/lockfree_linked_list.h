@@ -26,8 +26,10 @@ namespace fiber {
  *
  * 使用无锁链表管理等待某个条件的协程队列，提供统一的挂起/唤醒机制
  * 这是所有同步原语（Channel、Mutex、Condition等）的基础
+ *
+ * @tparam ThreadSafe false表示单线程所有权（thread-per-core模式），push/pop退化为普通读写，不再CAS
  */
-template<typename T>
+template<typename T, bool ThreadSafe = true>
 class LockFreeLinkedList {
 
 
@@ -55,7 +57,7 @@ class LockFreeLinkedList {
 
 public:
     LockFreeLinkedList() : head_(), tail_(), pool_(std::allocator<Node>()) {
-        Node *dummy = pool_.template construct<true, false>(pool_.null_handle());
+        Node *dummy = pool_.template construct<ThreadSafe, false>(pool_.null_handle());
         TaggedNodePtr dummy_node{dummy};
         head_.store(dummy_node, std::memory_order_release);
         tail_.store(dummy_node, std::memory_order_release);
@@ -90,7 +92,16 @@ public:
     // of the failure."
     template<typename Y>
     void push_back_lockfree(Y _data) {
-        Node *new_node = pool_.template construct<true, false>(std::move(_data), pool_.null_handle());
+        Node *new_node = pool_.template construct<ThreadSafe, false>(std::move(_data), pool_.null_handle());
+
+        if constexpr (!ThreadSafe) {
+            // 单线程所有权：直接挂到尾部，relaxed读写在x86上就是普通mov
+            Node *tail_ptr = tail_.load(std::memory_order_relaxed).get_ptr();
+            tail_ptr->next.store(TaggedNodePtr{new_node}, std::memory_order_relaxed);
+            tail_.store(TaggedNodePtr{new_node}, std::memory_order_relaxed);
+            size_.store(size_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
 
         while (true) {
             // Take tail and tail-next snapshot
@@ -128,10 +139,83 @@ public:
         }
     }
 
+    /**
+     * @brief 批量入队：先在私有链上串好所有节点，再用一次CAS挂到尾部
+     * @param first, last 待入队元素的迭代器区间（元素被move）
+     */
+    template<typename It>
+    void push_back_batch_lockfree(It first, It last) {
+        if (first == last) {
+            return;
+        }
+
+        Node *chain_head = nullptr;
+        Node *chain_tail = nullptr;
+        size_t count = 0;
+        for (; first != last; ++first, ++count) {
+            Node *node = pool_.template construct<ThreadSafe, false>(std::move(*first), pool_.null_handle());
+            if (chain_tail) {
+                chain_tail->next.store(TaggedNodePtr{node}, std::memory_order_relaxed);
+            } else {
+                chain_head = node;
+            }
+            chain_tail = node;
+        }
+
+        if constexpr (!ThreadSafe) {
+            Node *tail_ptr = tail_.load(std::memory_order_relaxed).get_ptr();
+            tail_ptr->next.store(TaggedNodePtr{chain_head}, std::memory_order_relaxed);
+            tail_.store(TaggedNodePtr{chain_tail}, std::memory_order_relaxed);
+            size_.store(size_.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+            return;
+        }
+
+        while (true) {
+            TaggedNodePtr tail = tail_.load(std::memory_order_acquire);
+            Node *tail_ptr = tail.get_ptr();
+
+            TaggedNodePtr next = tail_ptr->next.load(std::memory_order_acquire);
+            Node *next_ptr = next.get_ptr();
+
+            if (FIBER_UNLIKELY(tail != tail_.load(std::memory_order_acquire))) {
+                continue;
+            }
+
+            if (next_ptr != nullptr) {
+                TaggedNodePtr new_tail{next_ptr, tail.get_next_tag()};
+                tail_.compare_exchange_weak(tail, new_tail, std::memory_order_acq_rel, std::memory_order_relaxed);
+                continue;
+            }
+
+            TaggedNodePtr new_tail_next{chain_head, next.get_next_tag()};
+            if (tail_ptr->next.compare_exchange_weak(next, new_tail_next, std::memory_order_acq_rel,
+                                                     std::memory_order_relaxed)) {
+                size_.fetch_add(count, std::memory_order_relaxed);
+                // 尾指针直接跳到链尾；失败也没关系，其他线程会沿着next逐个推进
+                TaggedNodePtr new_tail{chain_tail, tail.get_next_tag()};
+                tail_.compare_exchange_weak(tail, new_tail, std::memory_order_acq_rel, std::memory_order_relaxed);
+                break;
+            }
+        }
+    }
+
     // 从队列头部取出节点
     std::optional<T> pop_front_lockfree() {
         T result;
 
+        if constexpr (!ThreadSafe) {
+            TaggedNodePtr head = head_.load(std::memory_order_relaxed);
+            Node *next_ptr = head->next.load(std::memory_order_relaxed).get_ptr();
+            if (next_ptr == nullptr) {
+                return {};
+            }
+            head_.store(TaggedNodePtr{next_ptr}, std::memory_order_relaxed);
+            size_.store(size_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+            result = std::move(next_ptr->data);
+            pool_.template destruct<false>(head);
+            return {std::move(result)};
+        }
+
         while (true) {
             TaggedNodePtr head = head_.load(std::memory_order_acquire);
             Node *head_ptr = head.get_ptr();
@@ -162,7 +246,7 @@ public:
             if (head_.compare_exchange_weak(head, new_head, std::memory_order_acq_rel, std::memory_order_relaxed)) {
                 size_.fetch_sub(1, std::memory_order_relaxed);
                 result = std::move(next_ptr->data);
-                pool_.template destruct<true>(head);
+                pool_.template destruct<ThreadSafe>(head);
                 break;
             }
         }
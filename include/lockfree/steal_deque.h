@@ -0,0 +1,171 @@
+//
+// Created by inory on 12/24/25.
+//
+
+#ifndef LOCKFREE_STEAL_DEQUE_H
+#define LOCKFREE_STEAL_DEQUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace fiber {
+
+/**
+ * @brief 可窃取的任务队列（Chase-Lev）
+ *
+ * 只有所有者线程可以在尾部push/pop（LIFO），任意线程（包括所有者）都可以从头部steal，每次steal一次CAS，
+ * 取出顺序是FIFO。所有者只在队列只剩最后一个元素时才需要和steal竞争CAS。和LockFreeLinkedList不同，多个线程并发steal是安全的：
+ * 元素先从槽位里读出来，CAS抢到top之后才算拿到，没有"CAS后再从已被回收的节点里move"的问题。
+ *
+ * 元素装箱后按指针存放，槽位只有原子的指针读写；扩容时旧数组保留到析构，
+ * 并发读到旧数组的steal不会访问已释放的内存。
+ * 参考：Lê et al., Correct and Efficient Work-Stealing for Weak Memory Models, PPoPP'13
+ */
+template<typename T>
+class StealDeque {
+    struct Array {
+        explicit Array(size_t capacity) : mask(capacity - 1), slots(new std::atomic<T *>[capacity]) {}
+
+        size_t capacity() const { return mask + 1; }
+        T *get(int64_t index) const { return slots[index & mask].load(std::memory_order_relaxed); }
+        void put(int64_t index, T *value) { slots[index & mask].store(value, std::memory_order_relaxed); }
+
+        size_t mask;
+        std::unique_ptr<std::atomic<T *>[]> slots;
+    };
+
+public:
+    explicit StealDeque(size_t capacity = 256) {
+        size_t rounded = 1;
+        while (rounded < capacity) {
+            rounded <<= 1;
+        }
+        arrays_.emplace_back(std::make_unique<Array>(rounded));
+        array_.store(arrays_.back().get(), std::memory_order_relaxed);
+    }
+
+    ~StealDeque() {
+        while (steal()) {
+        }
+    }
+
+    StealDeque(const StealDeque &) = delete;
+    StealDeque &operator=(const StealDeque &) = delete;
+
+    /**
+     * @brief 所有者线程在尾部追加
+     */
+    template<typename Y>
+    void push(Y &&value) {
+        const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        const int64_t top = top_.load(std::memory_order_acquire);
+        Array *array = array_.load(std::memory_order_relaxed);
+        if (bottom - top >= static_cast<int64_t>(array->capacity())) {
+            array = grow(array, top, bottom);
+        }
+        array->put(bottom, new T(std::forward<Y>(value)));
+        bottom_.store(bottom + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief 所有者线程批量追加，只发布一次bottom
+     * @param first, last 待入队元素的迭代器区间（元素被move）
+     */
+    template<typename It>
+    void push_batch(It first, It last) {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        const int64_t top = top_.load(std::memory_order_acquire);
+        Array *array = array_.load(std::memory_order_relaxed);
+        const auto count = static_cast<int64_t>(std::distance(first, last));
+        while (bottom + count - top > static_cast<int64_t>(array->capacity())) {
+            array = grow(array, top, bottom);
+        }
+        for (; first != last; ++first, ++bottom) {
+            array->put(bottom, new T(std::move(*first)));
+        }
+        bottom_.store(bottom, std::memory_order_release);
+    }
+
+    /**
+     * @brief 所有者线程从尾部取出最近push的元素，头部留给其他线程窃取
+     */
+    std::optional<T> pop() {
+        const int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        Array *array = array_.load(std::memory_order_relaxed);
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = top_.load(std::memory_order_relaxed);
+        if (top > bottom) {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return {};
+        }
+
+        T *boxed = array->get(bottom);
+        if (top == bottom) {
+            // 最后一个元素，和steal抢top，输了说明已被窃取
+            const bool won =
+                    top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            if (!won) {
+                return {};
+            }
+        }
+        std::optional<T> result(std::move(*boxed));
+        delete boxed;
+        return result;
+    }
+
+    /**
+     * @brief 从头部取出一个元素，可以在任意线程调用
+     */
+    std::optional<T> steal() {
+        while (true) {
+            int64_t top = top_.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const int64_t bottom = bottom_.load(std::memory_order_acquire);
+            if (top >= bottom) {
+                return {};
+            }
+
+            T *boxed = array_.load(std::memory_order_acquire)->get(top);
+            // CAS失败说明这个元素被别人拿走了，重读top继续
+            if (top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                std::optional<T> result(std::move(*boxed));
+                delete boxed;
+                return result;
+            }
+        }
+    }
+
+    size_t size() const {
+        const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        const int64_t top = top_.load(std::memory_order_relaxed);
+        return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+    }
+
+private:
+    Array *grow(Array *old, int64_t top, int64_t bottom) {
+        auto bigger = std::make_unique<Array>(old->capacity() * 2);
+        for (int64_t i = top; i < bottom; ++i) {
+            bigger->put(i, old->get(i));
+        }
+        Array *array = bigger.get();
+        arrays_.emplace_back(std::move(bigger));
+        array_.store(array, std::memory_order_release);
+        return array;
+    }
+
+    alignas(64) std::atomic<int64_t> top_{0};
+    alignas(64) std::atomic<int64_t> bottom_{0};
+    std::atomic<Array *> array_{nullptr};
+    std::vector<std::unique_ptr<Array>> arrays_; // 仅所有者线程访问，旧数组保留到析构
+};
+
+} // namespace fiber
+
+#endif // LOCKFREE_STEAL_DEQUE_H
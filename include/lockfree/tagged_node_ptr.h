@@ -5,6 +5,9 @@
 #ifndef TAGGED_NODE_PTR_H
 #define TAGGED_NODE_PTR_H
 
+#include <cstdint>
+#include <limits>
+
 namespace fiber {
 
 template<class T>
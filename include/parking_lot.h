@@ -0,0 +1,81 @@
+//
+// Created by inory on 12/14/25.
+//
+
+#ifndef FIBER_PARKING_LOT_H
+#define FIBER_PARKING_LOT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace fiber {
+
+/**
+ * 按地址等待（futex语义）的协程原语
+ *
+ * 挂起的fiber（或外部线程）记录在一张全局的、按地址哈希分桶的等待表里，和内核的futex表一样；
+ * 同步原语本身只需要一个原子字，不再各自持有一个堆上的WaitQueue。
+ * 典型用法：
+ *   while (state.load() == LOCKED) {
+ *       fiber::wait_on(state, LOCKED);   // state仍为LOCKED时挂起
+ *   }
+ *   ...
+ *   state.store(UNLOCKED);
+ *   fiber::notify_one(&state);
+ */
+
+namespace parking_lot {
+
+// 持有桶锁时调用：返回true表示条件仍然成立，可以挂起
+using Validate = bool (*)(const void *context);
+
+/**
+ * @brief 在addr上挂起当前fiber（外部线程则挂起线程），直到notify或超时
+ * @return true表示被notify唤醒或者校验失败没有挂起，false表示超时
+ */
+bool park(const void *addr, Validate validate, const void *context, int64_t timeout_ms);
+
+} // namespace parking_lot
+
+/**
+ * @brief word的值仍为old时挂起，直到有人对&word调用notify
+ *
+ * 与futex一样允许虚假唤醒，调用方需要在循环里重新检查条件。
+ * 挂起点：deadline已过的fiber直接抛出DeadlineExceeded
+ * @param word 等待的原子变量（std::atomic或LocalAtomic）
+ * @param old 期望值，不相等时立即返回
+ * @param timeout_ms 超时（毫秒），-1表示无限等待，0表示不挂起；外部线程不支持超时
+ * @return false表示超时
+ */
+template<typename Atomic, typename T>
+bool wait_on(Atomic &word, T old, int64_t timeout_ms = -1) {
+    struct Context {
+        Atomic *word;
+        T old;
+    } context{&word, old};
+
+    return parking_lot::park(
+            &word,
+            [](const void *ptr) {
+                auto *ctx = static_cast<const Context *>(ptr);
+                return ctx->word->load(std::memory_order_acquire) == ctx->old;
+            },
+            &context, timeout_ms);
+}
+
+/**
+ * @brief 唤醒一个在addr上等待的fiber（或线程），修改等待的原子变量之后调用
+ * @return 是否唤醒了等待者
+ */
+bool notify_one(const void *addr);
+
+/**
+ * @brief 唤醒所有在addr上等待的fiber（或线程）
+ * @return 被唤醒的数量
+ */
+size_t notify_all(const void *addr);
+
+} // namespace fiber
+
+#endif // FIBER_PARKING_LOT_H
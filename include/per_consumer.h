@@ -0,0 +1,152 @@
+//
+// Created by inory on 12/16/25.
+//
+
+#ifndef FIBER_PER_CONSUMER_H
+#define FIBER_PER_CONSUMER_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include "fiber_consumer.h"
+#include "scheduler.h"
+#include "sync.h"
+
+namespace fiber {
+
+/**
+ * @brief 按consumer分片的存储
+ *
+ * 每个FiberConsumer一份独占缓存行的T，fiber中通过local()直接按consumer id取到本线程的分片，
+ * 不需要哈希，也不需要thread_local加注册。适合计数器、对象池、缓存这类写多读少的数据：
+ *   PerConsumer<std::atomic<uint64_t>> requests;
+ *   requests.local().fetch_add(1, std::memory_order_relaxed);          // 热路径，只写本consumer的缓存行
+ *   auto total = requests.reduce(uint64_t{0}, [](uint64_t sum, const auto &v) { return sum + v.load(); });
+ *
+ * 分片在第一次访问时才按调度器的consumer数分配，可以定义成全局变量，静态初始化时不会启动调度器。
+ * 注意：local()只能在consumer线程上调用。分片只由所属consumer修改，
+ * for_each/reduce从其他线程读取时T需要自己保证读写安全（例如使用原子类型），结果是近似快照
+ */
+template<typename T>
+class PerConsumer {
+public:
+    /**
+     * @brief 为调度器的每个consumer构造一份T，args会被复制给每个分片（第一次访问时构造）
+     */
+    template<typename... Args>
+    explicit PerConsumer(const Args &...args) :
+        construct_([args...](void *shard) { new (shard) Shard(args...); }) {}
+
+    ~PerConsumer() {
+        if (Shard *shards = shards_.load(std::memory_order_acquire)) {
+            destroy(shards, size_);
+        }
+    }
+
+    PerConsumer(const PerConsumer &) = delete;
+    PerConsumer &operator=(const PerConsumer &) = delete;
+
+    /**
+     * @brief 当前consumer的分片
+     */
+    T &local() {
+        FiberConsumer *consumer = FiberConsumer::current();
+        if (!consumer) {
+            throw std::logic_error("PerConsumer::local() must be called on a consumer thread");
+        }
+        return shards()[static_cast<size_t>(consumer->id())].value;
+    }
+
+    T &operator[](size_t consumer_id) { return shards()[consumer_id].value; }
+    const T &operator[](size_t consumer_id) const { return shards()[consumer_id].value; }
+
+    size_t size() const {
+        shards();
+        return size_;
+    }
+
+    /**
+     * @brief 依次访问每个分片，f(T&)
+     */
+    template<typename F>
+    void for_each(F &&f) {
+        Shard *all = shards();
+        for (size_t i = 0; i < size_; ++i) {
+            f(all[i].value);
+        }
+    }
+
+    template<typename F>
+    void for_each(F &&f) const {
+        const Shard *all = shards();
+        for (size_t i = 0; i < size_; ++i) {
+            f(all[i].value);
+        }
+    }
+
+    /**
+     * @brief 合并所有分片：acc = op(acc, shard)
+     */
+    template<typename R, typename Op>
+    R reduce(R init, Op &&op) const {
+        const Shard *all = shards();
+        for (size_t i = 0; i < size_; ++i) {
+            init = op(std::move(init), all[i].value);
+        }
+        return init;
+    }
+
+private:
+    // 每个分片至少独占一个缓存行，避免相邻consumer之间伪共享
+    struct alignas(CACHE_LINE_SIZE) alignas(T) Shard {
+        T value;
+
+        template<typename... Args>
+        explicit Shard(const Args &...args) : value(args...) {}
+    };
+
+    std::function<void(void *)> construct_;
+    mutable std::once_flag once_;
+    mutable size_t size_{0}; // 在shards_发布之前写入
+    mutable std::atomic<Shard *> shards_{nullptr};
+
+    Shard *shards() const {
+        Shard *shards = shards_.load(std::memory_order_acquire);
+        return shards ? shards : allocate();
+    }
+
+    Shard *allocate() const {
+        // 构造抛异常时once_不会被标记，下一次访问重试
+        std::call_once(once_, [this] {
+            const auto count = static_cast<size_t>(Scheduler::getInst().getWorkerCount());
+            auto *shards = static_cast<Shard *>(::operator new[](sizeof(Shard) * count, std::align_val_t{alignof(Shard)}));
+            size_t constructed = 0;
+            try {
+                for (; constructed < count; ++constructed) {
+                    construct_(&shards[constructed]);
+                }
+            } catch (...) {
+                destroy(shards, constructed);
+                throw;
+            }
+            size_ = count;
+            shards_.store(shards, std::memory_order_release);
+        });
+        return shards_.load(std::memory_order_acquire);
+    }
+
+    static void destroy(Shard *shards, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            shards[i].~Shard();
+        }
+        ::operator delete[](shards, std::align_val_t{alignof(Shard)});
+    }
+};
+
+} // namespace fiber
+
+#endif // FIBER_PER_CONSUMER_H
@@ -0,0 +1,42 @@
+//
+// Created by inory on 12/22/25.
+//
+
+#ifndef FIBER_PROBES_H
+#define FIBER_PROBES_H
+
+/**
+ * USDT静态探针（provider为fiber）
+ *
+ * 探针编译成一条nop并在ELF的.note.stapsdt段里登记位置和参数，没有attach时没有额外开销，
+ * attach后可以用bpftrace直接观测线上进程，不需要重新编译，例如fiber从投递到开始运行的延迟：
+ *   bpftrace -e 'usdt:./server:fiber:schedule { @t[arg1] = nsecs; }
+ *                usdt:./server:fiber:resume /@t[arg0]/ { @lat = hist(nsecs - @t[arg0]); delete(@t[arg0]); }'
+ *
+ * 探针和参数：
+ *   create(fiber_id, stack_size)          resume(fiber_id, trace_id)
+ *   yield(fiber_id)  block(fiber_id)      done(fiber_id)
+ *   schedule(consumer_id, fiber_id)       FiberConsumer::schedule投递到本consumer队列
+ *   io_add(fd, events)  io_ready(fd, revents)
+ *   timer_fire(timer)  timer_cancel(timer)
+ *   chan_send_park(chan)  chan_send_unpark(chan)  chan_recv_park(chan)  chan_recv_unpark(chan)
+ *
+ * 系统没有<sys/sdt.h>（systemtap-sdt-dev）或定义了FIBER_NO_PROBES时，探针为空宏
+ */
+
+#if !defined(FIBER_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define FIBER_HAS_PROBES 1
+#endif
+#endif
+
+#ifdef FIBER_HAS_PROBES
+#define FIBER_PROBE1(name, a1) DTRACE_PROBE1(fiber, name, a1)
+#define FIBER_PROBE2(name, a1, a2) DTRACE_PROBE2(fiber, name, a1, a2)
+#else
+#define FIBER_PROBE1(name, a1) ((void) 0)
+#define FIBER_PROBE2(name, a1, a2) ((void) 0)
+#endif
+
+#endif // FIBER_PROBES_H
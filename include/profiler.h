@@ -0,0 +1,98 @@
+//
+// Created by inory on 12/19/25.
+//
+
+#ifndef FIBER_PROFILER_H
+#define FIBER_PROFILER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace fiber::profiler {
+
+/**
+ * 按fiber归因的采样CPU profiler
+ *
+ * perf只能把样本记到consumer线程上，看不出是哪个fiber、哪个请求在消耗CPU。
+ * 开启后每个consumer线程用timer_create按自己的线程CPU时间定时发送SIGPROF，
+ * 信号处理函数记录当前fiber的id、trace id和沿帧指针回溯的调用栈，写入该consumer独占的无锁环，
+ * 环写满后覆盖最旧的样本。典型用法：
+ *   profiler::start(99);
+ *   ...                                        // 跑负载
+ *   profiler::stop();
+ *   std::ofstream out("cpu.folded");
+ *   profiler::write_folded(out, profiler::Label::Trace);  // flamegraph.pl cpu.folded > cpu.svg
+ *
+ * 注意：调用栈依赖帧指针，需要用-fno-omit-frame-pointer编译；符号化使用dladdr，
+ * 可执行文件里的符号需要-rdynamic链接，否则只输出模块名加偏移
+ */
+
+/**
+ * @brief 折叠栈输出时在栈底附加的标签
+ */
+enum class Label {
+    None, // 只有调用栈
+    Fiber, // fiber:<id>
+    Trace, // trace:<trace id>，按请求归因
+};
+
+/**
+ * @brief 开始采样
+ * @param hz 每个consumer每秒CPU时间的采样次数
+ * @param samples_per_consumer 每个consumer环的容量（向上取整到2的幂）
+ * @return 已经在运行或者创建定时器失败时返回false
+ *
+ * 可以在调度器启动之前调用，这时各consumer的环在调度器分配consumer时创建，consumer线程启动后开始采样
+ */
+bool start(int hz = 99, size_t samples_per_consumer = 8192);
+
+/**
+ * @brief 停止采样，已记录的样本保留到reset或下一次start
+ */
+void stop();
+
+bool running();
+
+/**
+ * @brief 丢弃已记录的样本
+ */
+void reset();
+
+/**
+ * @brief 当前保留在环中的样本数
+ */
+size_t sample_count();
+
+/**
+ * @brief 输出折叠栈（flamegraph.pl / speedscope可以直接读取），每行"栈底;...;栈顶 次数"
+ */
+void write_folded(std::ostream &out, Label label = Label::Trace);
+
+/**
+ * @brief 输出gperftools格式的CPU profile，可以用pprof读取：pprof <binary> cpu.prof
+ *
+ * 这个格式没有标签，需要按请求归因时使用write_folded
+ */
+void write_pprof(std::ostream &out);
+
+// ==================== 调度器使用 ====================
+
+/**
+ * @brief 调度器启动consumer前调用，分配每个consumer的采样槽
+ */
+void attachConsumers(int count);
+
+/**
+ * @brief consumer线程进入调度循环时调用，采样正在运行时为该线程创建定时器
+ */
+void consumerOnline(int consumer_id);
+
+/**
+ * @brief consumer线程退出调度循环时调用
+ */
+void consumerOffline(int consumer_id);
+
+} // namespace fiber::profiler
+
+#endif // FIBER_PROFILER_H
@@ -0,0 +1,114 @@
+//
+// Created by inory on 12/15/25.
+//
+
+#ifndef FIBER_RCU_H
+#define FIBER_RCU_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+namespace fiber::rcu {
+
+/**
+ * 基于consumer调度循环静止点的RCU（QSBR）
+ *
+ * 每个consumer调度循环的一轮迭代都是一个静止点：这时该consumer上没有fiber正在执行，
+ * 只要所有consumer都经过一次静止点，之前开始的读者就都已经结束，旧数据可以安全回收。
+ * 读端不写任何共享内存，适合每个请求都要读、很少更新的路由表和配置表：
+ *   std::atomic<RouteTable *> g_routes;
+ *
+ *   // 读者（fiber中）
+ *   {
+ *       rcu::ReadGuard guard;
+ *       RouteTable *table = rcu::dereference(g_routes);
+ *       ...
+ *   }
+ *
+ *   // 写者
+ *   RouteTable *old = rcu::assign(g_routes, new RouteTable(...));
+ *   rcu::retire(old); // 或者 rcu::synchronize(); delete old;
+ *
+ *   // 定时器、IO watch、HighResTimer的回调直接运行在consumer调度循环里，只能用retire/call：
+ *   // 在这里synchronize会等待本consumer自己的静止点，永远等不到
+ *
+ * 注意：读者必须运行在consumer线程上（fiber中）。读临界区内允许挂起，
+ * 此时该consumer暂停报告静止点直到读者离开临界区，宽限期会相应延长
+ */
+
+namespace detail {
+extern thread_local uint32_t read_depth;
+} // namespace detail
+
+/**
+ * @brief 进入读临界区，只修改线程本地计数，可以嵌套
+ */
+inline void read_lock() noexcept { ++detail::read_depth; }
+
+/**
+ * @brief 离开读临界区
+ */
+inline void read_unlock() noexcept { --detail::read_depth; }
+
+class ReadGuard {
+public:
+    ReadGuard() noexcept { read_lock(); }
+    ~ReadGuard() { read_unlock(); }
+
+    ReadGuard(const ReadGuard &) = delete;
+    ReadGuard &operator=(const ReadGuard &) = delete;
+};
+
+/**
+ * @brief 读取受RCU保护的指针，只在读临界区内有效
+ */
+template<typename T>
+T *dereference(const std::atomic<T *> &ptr) noexcept {
+    return ptr.load(std::memory_order_acquire);
+}
+
+/**
+ * @brief 发布新版本，新对象在发布前的初始化对之后的读者可见
+ * @return 旧版本，需要在一个宽限期之后再释放
+ */
+template<typename T>
+T *assign(std::atomic<T *> &ptr, T *value) noexcept {
+    return ptr.exchange(value, std::memory_order_acq_rel);
+}
+
+/**
+ * @brief 等待一个宽限期：调用之前已经开始的读临界区全部结束后返回
+ *
+ * fiber中调用时挂起当前fiber，外部线程中调用时睡眠等待。
+ * 不能在读临界区内调用，也不能在consumer调度循环的回调（定时器、IO watch等）里调用，
+ * 否则本consumer永远不会报告静止点
+ */
+void synchronize();
+
+/**
+ * @brief 一个宽限期之后执行callback，不阻塞调用者
+ *
+ * 回调在后台回收fiber中批量执行，一批回调共用一个宽限期
+ */
+void call(std::function<void()> callback);
+
+/**
+ * @brief 一个宽限期之后delete ptr
+ */
+template<typename T>
+void retire(T *ptr) {
+    if (ptr) {
+        call([ptr]() { delete ptr; });
+    }
+}
+
+// 以下由调度器调用
+void attachConsumers(int count); // 启动consumer线程之前调用
+void consumerOnline(int consumer_id); // consumer调度循环开始
+void consumerOffline(int consumer_id); // consumer调度循环退出
+void quiescent(int consumer_id); // consumer调度循环的每轮迭代
+
+} // namespace fiber::rcu
+
+#endif // FIBER_RCU_H
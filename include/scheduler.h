@@ -2,16 +2,22 @@
 #define FIBER_SCHEDULER_H
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <type_traits>
 #include <vector>
 #include "fiber.h"
 
 namespace fiber {
 class TimerWheel;
+class HighResTimer;
+class BufferRing;
 }
 namespace fiber {
 class IOManager;
@@ -25,15 +31,20 @@ class FiberConsumer;
 class Scheduler {
 public:
     using ptr = std::shared_ptr<Scheduler>;
+    // 根fiber被准入控制拒绝时的回调，fiber已被置为DONE，不会再执行
+    using ShedHandler = std::function<void(const Fiber::ptr &)>;
 
     friend class Fiber;
     friend class WaitQueue;
+    friend class FiberConsumer;
 
     static Scheduler &getInst(); // 获取多线程调度器
     ~Scheduler();
 
     void init(int worker_count = 1); // 支持指定工作线程数
     void run();
+    // 在后台线程运行consumer 0，用于没有FIBER_MAIN、由外部线程驱动的程序；此后run()只等待调度器停止
+    void start();
     void stop();
     bool isRunning() const;
     SchedulerState getState() const;
@@ -41,15 +52,60 @@ public:
     bool hasReadyFibers() const;
 
     // 多线程调度专用接口
-    void scheduleImmediate(const Fiber::ptr& fiber); // 立即调度（多线程模式）
+    bool scheduleImmediate(const Fiber::ptr& fiber); // 立即调度（多线程模式），根fiber被准入控制拒绝时返回false
+    bool scheduleBatch(std::vector<Fiber::ptr> &fibers); // 批量调度新fiber，一次入队
+
+    /**
+     * @brief 设置准入控制的拒绝回调
+     *
+     * 需要在产生负载之前设置，回调在调用Fiber::go的线程上执行，不能阻塞
+     */
+    void setShedHandler(ShedHandler handler);
+    uint64_t getShedCount() const;
+
+    /**
+     * @brief 设置某个consumer的忙轮询窗口，0表示关闭
+     *
+     * 开启后该consumer空闲时先自旋window再阻塞在epoll_wait上，会占满一个核，只用于时延敏感的consumer。
+     * 也可以通过fiber.busy_poll.window_us和fiber.busy_poll.consumers（逗号分隔的id，留空为全部）配置
+     */
+    void setBusyPoll(int consumer_id, std::chrono::microseconds window);
+    // 忙轮询consumer上经IO::accept/IO::connect建立的socket设置的SO_BUSY_POLL（微秒），0表示不设置
+    int getBusyPollSocketUs() const { return busy_poll_socket_us_; }
+
+    /**
+     * @brief 从任意线程（包括gRPC、Kafka等外部回调线程）提交任务到fiber中执行
+     *
+     * 调度器的consumer 0还没有运行时会先在后台启动它；
+     * 在外部线程提交的任务是根fiber，被准入控制拒绝时future抛出broken_promise
+     * @return 任务结果的future，fiber中不要对它调用get()，那会阻塞整个consumer线程
+     */
+    template<typename F>
+    auto submit(F &&fn) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+        using Result = std::invoke_result_t<std::decay_t<F>>;
+
+        if (!main_loop_claimed_.load(std::memory_order_acquire)) {
+            start();
+        }
+
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(fn));
+        auto future = task->get_future();
+        Fiber::go([task]() { (*task)(); });
+        return future;
+    }
 
     int getWorkerCount() const;
     static FiberConsumer* getThreadLocalConsumer();
     static IOManager& getThreadLocalIOManager();
     static TimerWheel& getThreadLocalTimerManager();
+    // 未开启fiber.timer.high_resolution时返回nullptr
+    static HighResTimer* getThreadLocalHighResTimer();
+    // 第一次调用时创建本consumer的读缓冲区环
+    static BufferRing& getThreadLocalBufferRing();
 
 private:
-    SchedulerState state_;
+    std::atomic<SchedulerState> state_;
+    std::atomic<bool> main_loop_claimed_ {false}; // consumer 0的调度循环已由run()或start()接管
 
     // 单线程模式成员（仅为Lua语义提供main_fiber_）
     std::queue<Fiber::ptr> ready_queue_;
@@ -57,12 +113,35 @@ private:
     Fiber::ptr main_fiber_;
     size_t rr_index_ {0};
     int worker_count_ {0};
+    StackOptions stack_options_;
+    bool spawn_local_ {true}; // 新fiber优先放在spawn者所在的consumer上，由空闲consumer窃取来均衡
+    bool high_res_timer_ {false}; // 每个consumer创建HighResTimer，支持亚毫秒的定时
+
+    // 忙轮询，在startConsumers时应用到busy_poll_consumers_（为空表示全部consumer）
+    std::chrono::microseconds busy_poll_window_ {0};
+    std::vector<int> busy_poll_consumers_;
+    int busy_poll_socket_us_ {0};
+
+    // IO::read_any的读缓冲区环：每个consumer的缓冲区数量和大小，use_uring为false时只用epoll加缓冲池
+    int buffer_ring_entries_ {1024};
+    int buffer_ring_buffer_size_ {16 * 1024};
+    bool buffer_ring_use_uring_ {true};
+
+    // 准入控制（CoDel）：consumer队列的最小排队时延在interval内一直高于target时，拒绝新的根fiber
+    bool admission_enabled_ {false};
+    std::chrono::steady_clock::duration admission_target_ {std::chrono::milliseconds(5)};
+    std::chrono::steady_clock::duration admission_interval_ {std::chrono::milliseconds(100)};
+    ShedHandler shed_handler_;
+    std::atomic<uint64_t> shed_count_ {0};
 
     // lock-free consumers
     std::vector<std::unique_ptr<FiberConsumer>> consumers_;
 
     // 多线程调度方法
     FiberConsumer *selectConsumer(uint64_t trace_id);
+    FiberConsumer *placeConsumer(uint64_t trace_id);
+    bool admit(FiberConsumer *consumer, const Fiber::ptr &fiber) const;
+    void shed(const Fiber::ptr &fiber);
     void startConsumers(int count);
     void stopConsumers();
 
@@ -74,6 +153,20 @@ private:
     Scheduler &operator=(Scheduler &&) = delete;
 };
 
+/**
+ * @brief 在外部线程中同步执行一段fiber代码
+ *
+ * fn在fiber中运行，可以使用Channel、WaitGroup、IO等挂起操作；调用线程阻塞直到fn返回，
+ * fn抛出的异常会在调用线程重新抛出。已经在fiber中时直接调用fn
+ */
+template<typename F>
+auto block_on(F &&fn) -> std::invoke_result_t<std::decay_t<F>> {
+    if (Fiber::InSchedulableFiber()) {
+        return std::invoke(std::forward<F>(fn));
+    }
+    return Scheduler::getInst().submit(std::forward<F>(fn)).get();
+}
+
 } // namespace fiber
 
 // =========================
@@ -0,0 +1,352 @@
+//
+// Created by inory on 12/12/25.
+//
+
+#ifndef FIBER_SHM_CHANNEL_H
+#define FIBER_SHM_CHANNEL_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <optional>
+#include <system_error>
+#include <type_traits>
+
+#include "io_fiber.h"
+
+namespace fiber {
+
+/**
+ * @brief 跨进程共享的ShmChannel所需的全部fd
+ *
+ * memfd是共享内存段，两个eventfd是门铃：data_fd通知消费者"有数据"，space_fd通知生产者"有空位"。
+ * 通过fork继承，或者用sendTo/recvFrom经Unix socket（SCM_RIGHTS）传给另一个进程
+ */
+struct ShmChannelFds {
+    int memfd{-1};
+    int data_fd{-1};
+    int space_fd{-1};
+
+    bool sendTo(int unix_sock) const;
+    static std::optional<ShmChannelFds> recvFrom(int unix_sock);
+};
+
+namespace shm_detail {
+
+inline constexpr uint32_t kMagic = 0x46534843; // "FSHC"
+inline constexpr uint32_t kVersion = 1;
+
+// 共享内存段头部，生产者和消费者各自写的字段放在不同的缓存行上
+struct ShmRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t elem_size;
+    uint32_t capacity; // 2的幂
+    alignas(64) std::atomic<uint64_t> head; // 消费者写
+    alignas(64) std::atomic<uint64_t> tail; // 生产者写
+    alignas(64) std::atomic<uint32_t> consumer_waiting; // 消费者准备挂起，需要data门铃
+    alignas(64) std::atomic<uint32_t> producer_waiting; // 生产者准备挂起，需要space门铃
+    alignas(64) std::atomic<uint32_t> closed;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "ShmChannel requires address-free atomics");
+
+inline constexpr size_t kSlotsOffset = (sizeof(ShmRingHeader) + 63) / 64 * 64;
+
+// 创建共享内存段和门铃，返回的fd都带CLOEXEC，失败抛出std::system_error
+ShmChannelFds createSegment(size_t bytes);
+// 映射整个共享内存段，返回映射地址和长度
+void *mapSegment(int memfd, size_t &bytes);
+void unmapSegment(void *addr, size_t bytes);
+void closeFds(const ShmChannelFds &fds);
+void ringDoorbell(int event_fd);
+void drainDoorbell(int event_fd);
+
+} // namespace shm_detail
+
+/**
+ * @brief 跨进程的共享内存Channel（单生产者、单消费者）
+ *
+ * 数据走memfd映射里的无锁环形缓冲区，不经过内核、不做额外拷贝；只有对端准备挂起时才敲eventfd门铃，
+ * 门铃通过IO::wait注册在当前consumer的epoll上，等待时挂起的是fiber而不是线程（非fiber线程退化为poll）。
+ * 一个对象只扮演一个角色：生产者进程只调用send系列，消费者进程只调用recv系列；双向通信用两个Channel
+ * @tparam T 消息类型，必须是trivially copyable，且两个进程里的定义一致
+ */
+template<typename T>
+class ShmChannel {
+    static_assert(std::is_trivially_copyable_v<T>, "ShmChannel<T> requires a trivially copyable T");
+
+public:
+    using ptr = std::shared_ptr<ShmChannel<T>>;
+
+    /**
+     * @brief 创建新的共享内存Channel
+     * @param capacity 最少能缓存的消息数，向上取整到2的幂
+     */
+    static ptr create(size_t capacity);
+
+    /**
+     * @brief 映射对端创建的Channel，接管fds的所有权
+     */
+    static ptr attach(const ShmChannelFds &fds);
+
+    ~ShmChannel();
+
+    ShmChannel(const ShmChannel &) = delete;
+    ShmChannel &operator=(const ShmChannel &) = delete;
+
+    const ShmChannelFds &fds() const { return fds_; }
+
+    // 生产者接口
+    bool try_send(const T &value);
+    // 尽量多地写入，整批只发布一次、最多敲一次门铃，返回写入的数量
+    size_t try_send_batch(const T *values, size_t count);
+    // 缓冲区满时挂起，直到有空位；Channel已关闭返回false
+    bool send(const T &value, int64_t timeout_ms = -1);
+
+    // 消费者接口
+    bool try_recv(T &value);
+    size_t try_recv_batch(T *values, size_t max_count);
+    // 缓冲区空时挂起，直到有数据；已关闭且取空返回false，超时返回false且errno=ETIMEDOUT
+    bool recv(T &value, int64_t timeout_ms = -1);
+    // 挂起直到至少有一条消息，然后尽量多地取出
+    size_t recv_batch(T *values, size_t max_count, int64_t timeout_ms = -1);
+
+    void close();
+    bool is_closed() const { return header_->closed.load(std::memory_order_acquire) != 0; }
+    size_t size() const;
+    size_t capacity() const { return header_->capacity; }
+
+private:
+    ShmChannel(ShmChannelFds fds, void *base, size_t bytes);
+
+    T *slots() const { return reinterpret_cast<T *>(static_cast<char *>(base_) + shm_detail::kSlotsOffset); }
+
+    // 在对端挂起前检查条件：先声明自己要等，再检查一次，避免门铃丢失
+    template<typename Ready>
+    bool park(std::atomic<uint32_t> &waiting, int event_fd, Ready ready, int64_t timeout_ms);
+    static void ring(std::atomic<uint32_t> &waiting, int event_fd);
+
+    ShmChannelFds fds_;
+    void *base_;
+    size_t bytes_;
+    shm_detail::ShmRingHeader *header_;
+    uint64_t mask_;
+    uint64_t cached_head_{0}; // 生产者本地缓存的消费位置
+    uint64_t cached_tail_{0}; // 消费者本地缓存的生产位置
+};
+
+// 实现
+template<typename T>
+typename ShmChannel<T>::ptr ShmChannel<T>::create(size_t capacity) {
+    size_t slots = 1;
+    while (slots < capacity) {
+        slots <<= 1;
+    }
+
+    size_t bytes = shm_detail::kSlotsOffset + slots * sizeof(T);
+    ShmChannelFds fds = shm_detail::createSegment(bytes);
+    void *base;
+    try {
+        base = shm_detail::mapSegment(fds.memfd, bytes);
+    } catch (...) {
+        shm_detail::closeFds(fds);
+        throw;
+    }
+
+    auto *header = new (base) shm_detail::ShmRingHeader{};
+    header->version = shm_detail::kVersion;
+    header->elem_size = sizeof(T);
+    header->capacity = static_cast<uint32_t>(slots);
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = shm_detail::kMagic;
+
+    return ptr(new ShmChannel<T>(fds, base, bytes));
+}
+
+template<typename T>
+typename ShmChannel<T>::ptr ShmChannel<T>::attach(const ShmChannelFds &fds) {
+    size_t bytes = 0;
+    void *base = shm_detail::mapSegment(fds.memfd, bytes);
+
+    auto *header = static_cast<shm_detail::ShmRingHeader *>(base);
+    if (bytes < shm_detail::kSlotsOffset || header->magic != shm_detail::kMagic ||
+        header->version != shm_detail::kVersion || header->elem_size != sizeof(T) ||
+        bytes < shm_detail::kSlotsOffset + static_cast<size_t>(header->capacity) * sizeof(T)) {
+        shm_detail::unmapSegment(base, bytes);
+        throw std::system_error(std::make_error_code(std::errc::invalid_argument),
+                                "ShmChannel::attach: segment layout mismatch");
+    }
+
+    return ptr(new ShmChannel<T>(fds, base, bytes));
+}
+
+template<typename T>
+ShmChannel<T>::ShmChannel(ShmChannelFds fds, void *base, size_t bytes) :
+    fds_(fds), base_(base), bytes_(bytes), header_(static_cast<shm_detail::ShmRingHeader *>(base)),
+    mask_(header_->capacity - 1) {
+    cached_head_ = header_->head.load(std::memory_order_acquire);
+    cached_tail_ = header_->tail.load(std::memory_order_acquire);
+}
+
+template<typename T>
+ShmChannel<T>::~ShmChannel() {
+    shm_detail::unmapSegment(base_, bytes_);
+    shm_detail::closeFds(fds_);
+}
+
+template<typename T>
+bool ShmChannel<T>::try_send(const T &value) {
+    return try_send_batch(&value, 1) == 1;
+}
+
+template<typename T>
+size_t ShmChannel<T>::try_send_batch(const T *values, size_t count) {
+    if (is_closed()) {
+        return 0;
+    }
+
+    uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+    size_t free_slots = header_->capacity - (tail - cached_head_);
+    if (free_slots < count) {
+        cached_head_ = header_->head.load(std::memory_order_acquire);
+        free_slots = header_->capacity - (tail - cached_head_);
+    }
+
+    size_t n = count < free_slots ? count : free_slots;
+    if (n == 0) {
+        return 0;
+    }
+
+    T *buffer = slots();
+    for (size_t i = 0; i < n; ++i) {
+        std::memcpy(&buffer[(tail + i) & mask_], &values[i], sizeof(T));
+    }
+    header_->tail.store(tail + n, std::memory_order_release);
+    ring(header_->consumer_waiting, fds_.data_fd);
+    return n;
+}
+
+template<typename T>
+bool ShmChannel<T>::send(const T &value, int64_t timeout_ms) {
+    while (true) {
+        if (is_closed()) {
+            return false;
+        }
+        if (try_send(value)) {
+            return true;
+        }
+        auto has_space = [this]() {
+            return header_->tail.load(std::memory_order_relaxed) - header_->head.load(std::memory_order_acquire) <
+                   header_->capacity;
+        };
+        if (!park(header_->producer_waiting, fds_.space_fd, has_space, timeout_ms)) {
+            return false;
+        }
+    }
+}
+
+template<typename T>
+bool ShmChannel<T>::try_recv(T &value) {
+    return try_recv_batch(&value, 1) == 1;
+}
+
+template<typename T>
+size_t ShmChannel<T>::try_recv_batch(T *values, size_t max_count) {
+    uint64_t head = header_->head.load(std::memory_order_relaxed);
+    if (cached_tail_ - head < max_count) {
+        cached_tail_ = header_->tail.load(std::memory_order_acquire);
+    }
+
+    size_t available = cached_tail_ - head;
+    size_t n = max_count < available ? max_count : available;
+    if (n == 0) {
+        return 0;
+    }
+
+    T *buffer = slots();
+    for (size_t i = 0; i < n; ++i) {
+        std::memcpy(&values[i], &buffer[(head + i) & mask_], sizeof(T));
+    }
+    header_->head.store(head + n, std::memory_order_release);
+    ring(header_->producer_waiting, fds_.space_fd);
+    return n;
+}
+
+template<typename T>
+bool ShmChannel<T>::recv(T &value, int64_t timeout_ms) {
+    return recv_batch(&value, 1, timeout_ms) == 1;
+}
+
+template<typename T>
+size_t ShmChannel<T>::recv_batch(T *values, size_t max_count, int64_t timeout_ms) {
+    while (true) {
+        size_t n = try_recv_batch(values, max_count);
+        if (n > 0) {
+            return n;
+        }
+        // 先检查关闭再确认为空，关闭前写入的消息不会丢
+        bool closed = is_closed();
+        if (closed && try_recv_batch(values, max_count) == 0) {
+            return 0;
+        }
+        auto has_data = [this]() {
+            return header_->tail.load(std::memory_order_acquire) != header_->head.load(std::memory_order_relaxed) ||
+                   is_closed();
+        };
+        if (!park(header_->consumer_waiting, fds_.data_fd, has_data, timeout_ms)) {
+            return 0;
+        }
+    }
+}
+
+template<typename T>
+void ShmChannel<T>::close() {
+    header_->closed.store(1, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // 两边的等待者都叫醒
+    shm_detail::ringDoorbell(fds_.data_fd);
+    shm_detail::ringDoorbell(fds_.space_fd);
+}
+
+template<typename T>
+size_t ShmChannel<T>::size() const {
+    uint64_t head = header_->head.load(std::memory_order_acquire);
+    uint64_t tail = header_->tail.load(std::memory_order_acquire);
+    return static_cast<size_t>(tail - head);
+}
+
+template<typename T>
+template<typename Ready>
+bool ShmChannel<T>::park(std::atomic<uint32_t> &waiting, int event_fd, Ready ready, int64_t timeout_ms) {
+    waiting.store(1, std::memory_order_relaxed);
+    // 与ring()里的fence配对：要么对端看到waiting，要么这里看到对端的发布
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ready()) {
+        waiting.store(0, std::memory_order_relaxed);
+        return true;
+    }
+
+    auto result = IO::wait(event_fd, POLLIN, timeout_ms);
+    shm_detail::drainDoorbell(event_fd);
+    waiting.store(0, std::memory_order_relaxed);
+    return result.has_value();
+}
+
+template<typename T>
+void ShmChannel<T>::ring(std::atomic<uint32_t> &waiting, int event_fd) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // 对端在忙时不做系统调用；同一次挂起只敲一次门铃
+    if (waiting.load(std::memory_order_relaxed) != 0 && waiting.exchange(0, std::memory_order_relaxed) != 0) {
+        shm_detail::ringDoorbell(event_fd);
+    }
+}
+
+} // namespace fiber
+
+#endif // FIBER_SHM_CHANNEL_H
@@ -0,0 +1,55 @@
+//
+// Created by inory on 12/10/25.
+//
+
+#ifndef FIBER_SIGNALS_H
+#define FIBER_SIGNALS_H
+
+#include <csignal>
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+
+namespace fiber::signals {
+
+/**
+ * 基于signalfd的协程信号处理
+ *
+ * 信号不再走异步的信号处理函数，而是统一由一个signalfd接收：signalfd注册在consumer 0的IOManager上，
+ * 由一个常驻的分发fiber读取，再唤醒在wait()上等待对应信号的fiber（或外部线程）。
+ * 典型用法：
+ *   Fiber::go([] {
+ *       while (auto sig = signals::wait({SIGHUP, SIGTERM})) {
+ *           if (*sig == SIGHUP) reload(); else { drain(); break; }
+ *       }
+ *   });
+ *
+ * 注意：signalfd只能收到被阻塞的信号。block()会阻塞调用线程和所有consumer线程，
+ * 其他外部线程需要在创建之前由父线程阻塞（继承信号掩码），否则信号可能按默认动作投递到这些线程上
+ */
+
+/**
+ * @brief 在调用线程和所有consumer线程上阻塞set中的信号，并把它们加入signalfd
+ *
+ * wait()会自动调用，提前调用可以尽早关闭默认的信号处理动作（例如SIGTERM直接退出进程）
+ */
+void block(const sigset_t &set);
+
+void block(std::initializer_list<int> signos);
+
+/**
+ * @brief 等待set中任意一个信号
+ *
+ * 在fiber中调用时挂起fiber；在外部线程中调用时挂起线程（外部线程不支持超时）。
+ * 每个到达的信号只唤醒一个等待者；没有等待者时计入待处理计数，下一次wait直接返回
+ * @param set 等待的信号集合
+ * @param timeout_ms 超时（毫秒），-1表示无限等待
+ * @return 收到的信号编号；超时返回nullopt，errno=ETIMEDOUT
+ */
+std::optional<int> wait(const sigset_t &set, int64_t timeout_ms = -1);
+
+std::optional<int> wait(std::initializer_list<int> signos, int64_t timeout_ms = -1);
+
+} // namespace fiber::signals
+
+#endif // FIBER_SIGNALS_H
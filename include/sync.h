@@ -6,10 +6,13 @@
 #include <memory>
 #include <mutex>
 #include <system_error>
+#include <thread>
 
+#include "contention.h"
 #include "fiber.h"
+#include "local_atomic.h"
+#include "parking_lot.h"
 #include "serika/basic/logger.h"
-#include "wait_queue.h"
 
 namespace fiber {
 
@@ -17,7 +20,9 @@ namespace fiber {
  * @brief 协程级互斥量
  *
  * 与std::mutex不同，FiberMutex不会阻塞操作系统线程，
- * 而是挂起当前协程，让其他协程可以在同一线程中继续执行
+ * 而是挂起当前协程，让其他协程可以在同一线程中继续执行。
+ * 整个锁只有一个原子字，等待者挂在全局的按地址等待表上（见parking_lot.h）。
+ * 开启contention profiler时，有竞争的加锁会按采样率记录等待和持有时间（见contention.h）
  */
 class FiberMutex {
 public:
@@ -58,11 +63,16 @@ public:
     }
 
 private:
-    std::atomic<bool> locked_; // 锁状态
-    std::unique_ptr<WaitQueue> waiters_; // 等待获取锁的协程队列
+    // 0: 未加锁  1: 已加锁且没有等待者  2: 已加锁且可能有等待者
+    static constexpr uint32_t kUnlocked = 0;
+    static constexpr uint32_t kLocked = 1;
+    static constexpr uint32_t kContended = 2;
 
-    // 内部辅助方法
-    bool try_acquire_lock();
+    LocalAtomic<uint32_t> state_; // 锁状态
+
+    // 被contention profiler采样的这次加锁：拿到锁的时间（0表示未采样）和调用点，只由持锁者读写
+    int64_t profile_acquired_ns_{0};
+    const void *profile_site_{nullptr};
 };
 
 /**
@@ -135,17 +145,26 @@ public:
     void notify_all();
 
 private:
-    std::unique_ptr<WaitQueue> waiters_; // 等待条件的协程队列
+    LocalAtomic<uint32_t> seq_; // 每次notify递增，等待者在这个字上挂起
 };
 
 /**
  * @brief Go风格的WaitGroup
  *
- * 用于等待一组协程完成
+ * 用于等待一组协程完成。
+ * Sharded模式下计数分散在每个consumer一个的分片上，add/done只修改本consumer的分片；
+ * counter_只记录非零分片的个数，只在分片归零或由零变非零时才被修改，
+ * 适合成千上万个子任务在多个consumer上并发done的扇入场景。
+ * thread-per-core模式下WaitGroup不跨consumer使用，Sharded退化为Single
  */
 class WaitGroup {
 public:
-    WaitGroup();
+    enum class Mode {
+        Single, // 单个原子计数器
+        Sharded, // 按consumer分片计数
+    };
+
+    explicit WaitGroup(Mode mode = Mode::Single);
     ~WaitGroup();
 
     // 禁用拷贝和移动
@@ -171,20 +190,47 @@ public:
 
     /**
      * @brief 获取当前计数
+     * Sharded模式下是各分片之和，并发修改时只是近似值
      */
     int count() const;
 
 private:
-    std::atomic<int> counter_; // 等待计数器
-    std::unique_ptr<WaitQueue> waiters_; // 等待完成的协程队列
-
-    void notify_waiters_if_done();
+    struct Shard;
+
+    // Single模式下是等待计数；Sharded模式下是非零分片数加上正在搬运额度的done数
+    // 两种模式下等待者都在这个字上挂起，归零即完成
+    LocalAtomic<int> counter_;
+    std::unique_ptr<Shard[]> shards_; // Single模式下为空
+    size_t shard_count_{0};
+    // done跨分片搬运多余额度的次数和正在进行的搬运数，用来判断一次全量扫描是否可信
+    std::atomic<uint64_t> migrations_{0};
+    std::atomic<uint32_t> migrating_{0};
+
+    size_t localShard() const;
+    void shardDeposit(Shard &shard, int64_t n);
+    int64_t shardWithdraw(Shard &shard, int64_t n);
+    void shardedDone(int64_t n);
+    void releaseActive();
 };
 
 #ifndef CACHE_LINE_SIZE
 #define CACHE_LINE_SIZE 64
 #endif
 
+// CPU 友好自旋（减少功耗，提高性能）
+inline void cpu_relax() noexcept {
+    // x86/x64 特定优化：PAUSE 指令
+#if defined(__x86_64__) || defined(_M_X64)
+    __asm__ volatile("pause" ::: "memory");
+#elif defined(__aarch64__) || defined(__arm__)
+    // ARM 特定优化
+    __asm__ volatile("yield" ::: "memory");
+#else
+    // 通用实现：编译器屏障
+    std::atomic_thread_fence(std::memory_order_relaxed);
+#endif
+}
+
 class alignas(CACHE_LINE_SIZE) SpinLock {
 private:
     // 使用 atomic<bool> 而不是 atomic_flag，以便支持更多操作
@@ -235,21 +281,6 @@ public:
         return !lock_.exchange(true, std::memory_order_acquire);
     }
 
-private:
-    // CPU 友好自旋（减少功耗，提高性能）
-    static void cpu_relax() noexcept {
-        // x86/x64 特定优化：PAUSE 指令
-#if defined(__x86_64__) || defined(_M_X64)
-        __asm__ volatile("pause" ::: "memory");
-#elif defined(__aarch64__) || defined(__arm__)
-        // ARM 特定优化
-        __asm__ volatile("yield" ::: "memory");
-#else
-        // 通用实现：编译器屏障
-        std::atomic_thread_fence(std::memory_order_relaxed);
-#endif
-    }
-
 public:
     // 禁止拷贝和移动
     SpinLock(const SpinLock &) = delete;
@@ -260,6 +291,93 @@ public:
     ~SpinLock() = default;
 };
 
+/**
+ * @brief MCS排队自旋锁
+ *
+ * 等待者排成链表，每个等待者只在自己节点的缓存行上自旋，释放时把锁直接交给后继，
+ * 严格FIFO。高竞争下比SpinLock少了所有等待者争抢同一缓存行的开销，适合多核合并统计等短临界区。
+ * 队列节点来自线程本地的空闲链表，因此接口和SpinLock一样满足BasicLockable；
+ * 和SpinLock一样不能在持锁期间挂起fiber。
+ * 注意：线程数超过核数时，FIFO交接会等待被抢占的后继重新上CPU，此时SpinLock反而更快
+ */
+class alignas(CACHE_LINE_SIZE) MCSLock {
+public:
+    struct alignas(CACHE_LINE_SIZE) Node {
+        std::atomic<Node *> next{nullptr};
+        std::atomic<bool> waiting{false};
+        Node *free_next{nullptr}; // 空闲链表
+    };
+
+    constexpr MCSLock() noexcept = default;
+    ~MCSLock() = default;
+
+    // 禁止拷贝和移动
+    MCSLock(const MCSLock &) = delete;
+    MCSLock &operator=(const MCSLock &) = delete;
+
+    void lock() noexcept;
+    void unlock() noexcept;
+    bool try_lock() noexcept;
+
+private:
+    static constexpr uint32_t kMaxSpins = 128; // 超过后让出线程，避免前驱被抢占时空转
+
+    std::atomic<Node *> tail_{nullptr};
+    Node *holder_{nullptr}; // 持锁者的节点，只由持锁者读写
+};
+
+/**
+ * @brief 票据自旋锁
+ *
+ * 按取票顺序FIFO获取锁，实现比MCSLock简单，但所有等待者仍在同一缓存行（now_serving_）上自旋，
+ * 适合竞争线程数不多、需要公平性的场景
+ */
+class TicketLock {
+public:
+    constexpr TicketLock() noexcept = default;
+    ~TicketLock() = default;
+
+    // 禁止拷贝和移动
+    TicketLock(const TicketLock &) = delete;
+    TicketLock &operator=(const TicketLock &) = delete;
+
+    void lock() noexcept {
+        const uint32_t ticket = next_ticket_.fetch_add(1, std::memory_order_relaxed);
+        uint32_t spins = 0;
+        while (true) {
+            uint32_t serving = now_serving_.load(std::memory_order_acquire);
+            if (serving == ticket) {
+                return;
+            }
+            // 按前面排队的人数退避，减少对now_serving_所在缓存行的读取
+            for (uint32_t i = ticket - serving; i > 0; --i) {
+                cpu_relax();
+            }
+            if (++spins > kMaxSpins) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void unlock() noexcept {
+        // 只有持锁者会写now_serving_
+        now_serving_.store(now_serving_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool try_lock() noexcept {
+        uint32_t serving = now_serving_.load(std::memory_order_acquire);
+        uint32_t expected = serving;
+        return next_ticket_.compare_exchange_strong(expected, serving + 1, std::memory_order_acquire,
+                                                    std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr uint32_t kMaxSpins = 128; // 超过后让出线程
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> next_ticket_{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> now_serving_{0};
+};
+
 
 } // namespace fiber
 
@@ -12,6 +12,7 @@
 #include <vector>
 
 // #include "concurrentqueue.h"
+#include "local_atomic.h"
 #include "lockfree/lockfree_linked_list.h"
 
 namespace fiber {
@@ -31,8 +32,10 @@ struct TimerNode {
     Duration timeout; // 超时时长
     size_t rotations; // 剩余轮数
     Callback callback; // 回调函数
-    std::atomic<bool> repeat; // 是否重复
-    std::atomic<bool> canceled; // 是否已取消
+    LocalAtomic<bool> repeat; // 是否重复
+    LocalAtomic<bool> canceled; // 是否已取消
+    bool idle{false}; // 空闲定时器：到期时按最近一次活动时间顺延
+    LocalAtomic<int64_t> last_active{0}; // 空闲定时器最近一次活动时间（steady_clock计数）
 
     TimerNode(Duration t, Callback cb, bool rep = false) :
         timeout(t), rotations(0), callback(std::move(cb)), repeat(rep), canceled(false) {}
@@ -73,13 +76,32 @@ public:
      */
     TimerPtr addTimer(uint64_t ms, Callback cb, bool repeat = false);
 
+    /**
+     * @brief 添加空闲超时定时器（毫秒）
+     * @param ms 空闲超时时间（毫秒）
+     * @param cb 回调函数
+     * @return 定时器指针
+     *
+     * 距离最近一次touch超过ms毫秒时触发一次回调。touch只记录活动时间，不重新入轮，
+     * 定时器到期时再比较活动时间，未空闲够就按剩余时间重新放回时间轮。
+     * 适合keep-alive连接这类每个请求都要重置超时、但极少真正超时的场景
+     */
+    TimerPtr addIdleTimer(uint64_t ms, Callback cb);
+
+    /**
+     * @brief 记录一次活动，把空闲定时器的到期时间顺延到now + timeout
+     *
+     * 只有一次时间戳写入，不分配内存，也不访问时间轮
+     */
+    static void touch(const TimerPtr &timer);
+
     /**
      * @brief 刷新定时器（重置超时时间）
      * @param timer 要刷新的定时器
      * @return 新的定时器（旧的会被取消）
      *
      * 注意：在无锁实现中，refresh会取消旧timer并返回一个新的timer，
-     *       新timer使用相同的回调和超时时间
+     *       新timer使用相同的回调和超时时间；空闲定时器只做touch并返回原timer
      */
     TimerPtr refresh(TimerPtr timer);
 
@@ -136,6 +158,11 @@ private:
      */
     void processPendingTimers();
 
+    /**
+     * @brief 空闲定时器距离真正到期的剩余时间，空闲够了返回0
+     */
+    static Duration idleRemaining(const TimerNode &timer, TimePoint now);
+
 private:
     // 时间轮配置
     const size_t slots_; // slot数量
@@ -146,7 +173,7 @@ private:
     size_t current_slot_; // 当前slot索引
 
     // 待添加队列（多线程安全）
-    LockFreeLinkedList<TimerPtr> pending_timers_; // 待添加的定时器队列
+    LockFreeLinkedList<TimerPtr, kLocalThreadSafe> pending_timers_; // 待添加的定时器队列
     // moodycamel::ConcurrentQueue<TimerPtr> pending_timers_;    // 待添加的定时器队列
 
     // 运行状态
@@ -1,19 +1,42 @@
 #ifndef FIBER_WAIT_QUEUE_H
 #define FIBER_WAIT_QUEUE_H
 
+#include <atomic>
 #include <memory>
 
 // #include "concurrentqueue.h"
 #include "fiber.h"
+#include "local_atomic.h"
 #include "lockfree_linked_list.h"
 
 namespace fiber {
 
+/**
+ * @brief 非fiber线程（外部std::thread）的挂起/唤醒器
+ *
+ * 许可语义：unpark先于park发生时，park直接返回，不会丢失唤醒
+ */
+class ThreadParker {
+public:
+    // 当前线程的parker，线程内复用
+    static std::shared_ptr<ThreadParker> current();
+
+    void park();
+    void unpark();
+
+private:
+    std::atomic<uint32_t> permit_{0};
+};
+
 /**
  * @brief 无锁协程等待队列
  *
  * 使用无锁链表管理等待某个条件的协程队列，提供统一的挂起/唤醒机制
  * 这是所有同步原语（Channel、Mutex、Condition等）的基础
+ *
+ * 外部线程（gRPC、Kafka回调线程等）也可以wait和notify：wait会挂起整个线程，
+ * notify把fiber投递回它所在consumer的运行队列。thread-per-core模式下等待队列不是线程安全的，
+ * 外部线程只能通过Scheduler::submit与fiber交互
  */
 class WaitQueue {
 public:
@@ -29,11 +52,54 @@ public:
     /**
      * @brief 将当前协程加入等待队列并挂起
      *
-     * 调用此方法的协程会被挂起，直到被notify唤醒
-     * 必须在协程上下文中调用
+     * 调用此方法的协程会被挂起，直到被notify唤醒；
+     * 在外部线程中调用时挂起当前线程。不能在consumer线程的调度循环（定时器、IO回调）里调用
      */
     void wait();
 
+    /**
+     * @brief 入队后再检查一次条件，条件已满足时撤销等待，不会丢失"检查条件"和"入队"之间发生的notify
+     *
+     * 调用方需要保证：使ready()变为true的一方在修改状态之后调用notify
+     * @param ready 条件谓词，返回true时不再等待
+     */
+    template<typename Predicate>
+    void wait_unless(Predicate ready) {
+        WaitTicket ticket = prepare_wait();
+        if (ready() && cancel_wait(ticket)) {
+            return;
+        }
+        commit_wait(ticket);
+    }
+
+    /**
+     * @brief 两阶段等待的凭据
+     *
+     * prepare_wait先入队，之后可以释放锁、再次检查条件，最后commit_wait挂起或cancel_wait撤销。
+     * 凭据只能被notify或cancel之一认领一次，认领失败的notify会继续唤醒下一个等待者；
+     * 同一个凭据可以加入多个队列（同时等待多个事件），只会被唤醒一次
+     */
+    struct WaitTicket {
+        Fiber::ptr fiber; // fiber等待时非空
+        std::shared_ptr<ThreadParker> parker; // 外部线程等待时非空
+        std::shared_ptr<std::atomic<bool>> claimed; // 为空表示无条件唤醒（普通wait）
+    };
+
+    // 为当前fiber（或外部线程）创建凭据，不入队
+    static WaitTicket make_ticket();
+    WaitTicket prepare_wait();
+    void prepare_wait(const WaitTicket &ticket);
+    static void commit_wait(WaitTicket &ticket);
+    /**
+     * @return true表示撤销成功；false表示已经被notify认领，必须再调用commit_wait消费这次唤醒
+     */
+    static bool cancel_wait(WaitTicket &ticket);
+    /**
+     * @brief 不经过队列直接认领并唤醒凭据的持有者，用于超时等场景
+     * @return false表示已经被其他notify认领或已撤销
+     */
+    static bool notify(WaitTicket &ticket);
+
     /**
      * @brief 唤醒一个等待的协程
      *
@@ -51,10 +117,11 @@ public:
     void push_back_lockfree(Fiber::ptr fiber);
 
 private:
-    Fiber::ptr pop_front_lockfree();
+    std::optional<WaitTicket> pop_front_lockfree();
+    static void checkWaitContext();
 
     // moodycamel::ConcurrentQueue<Fiber::ptr> lock_free_queue_;
-    LockFreeLinkedList<Fiber::ptr> lock_free_queue_;
+    LockFreeLinkedList<WaitTicket, kLocalThreadSafe> lock_free_queue_;
 };
 
 } // namespace fiber
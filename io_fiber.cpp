@@ -1,4 +1,5 @@
 #include "io_fiber.h"
+#include <algorithm>
 #include <cerrno>
 #include <cstdint>
 #include <cstring>
@@ -9,6 +10,7 @@
 #include <sys/uio.h>
 #include <unistd.h>
 #include "fiber.h"
+#include "fiber_consumer.h"
 #include "scheduler.h"
 #include "serika/basic/logger.h"
 
@@ -22,6 +24,47 @@ static bool setNonBlocking(int fd) {
     return fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0;
 }
 
+int64_t IO::capTimeoutToDeadline(const Fiber *fiber, int64_t timeout_ms) {
+    // 带deadline的fiber，等待时间不超过deadline的剩余时间
+    if (fiber && fiber->GetDeadline()) {
+        auto remaining = std::chrono::ceil<std::chrono::milliseconds>(*fiber->GetDeadline() - Fiber::Clock::now());
+        int64_t remaining_ms = std::max<int64_t>(remaining.count(), 1);
+        if (timeout_ms < 0 || remaining_ms < timeout_ms) {
+            timeout_ms = remaining_ms;
+        }
+    }
+    return timeout_ms;
+}
+
+bool IO::set_busy_poll(int fd, int busy_poll_us) {
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us, sizeof(busy_poll_us)) < 0) {
+        return false;
+    }
+#ifdef SO_PREFER_BUSY_POLL
+    int prefer = busy_poll_us > 0 ? 1 : 0;
+    // 5.11之前的内核不认识这个选项，SO_BUSY_POLL已经生效，忽略失败
+    setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer));
+#endif
+    return true;
+}
+
+void IO::applyBusyPoll(int fd) {
+    auto *consumer = FiberConsumer::current();
+    if (!consumer || !consumer->isBusyPolling()) {
+        return;
+    }
+    int busy_poll_us = Scheduler::getInst().getBusyPollSocketUs();
+    if (busy_poll_us <= 0 || set_busy_poll(fd, busy_poll_us)) {
+        return;
+    }
+
+    // 通常是缺少CAP_NET_ADMIN，每个连接都会失败，只报一次
+    static std::atomic<bool> warned{false};
+    if (!warned.exchange(true, std::memory_order_relaxed)) {
+        LOG_WARN("setsockopt(SO_BUSY_POLL={}) failed: {}", busy_poll_us, strerror(errno));
+    }
+}
+
 template<typename Func>
 std::optional<ssize_t> IO::doIO(int fd, IOEvent event, Func &&op, bool use_et, int64_t timeout_ms) {
 
@@ -31,6 +74,9 @@ std::optional<ssize_t> IO::doIO(int fd, IOEvent event, Func &&op, bool use_et, i
     auto timeout_state = std::make_shared<std::atomic<bool>>(false);
     auto woken_state = std::make_shared<std::atomic<bool>>(false);
 
+    auto current = Fiber::GetCurrentFiberPtr();
+    timeout_ms = capTimeoutToDeadline(current.get(), timeout_ms);
+
     TimerWheel::TimerPtr timer;
     // timeout_ms == -1 means infinite wait (no timer)
     if (timeout_ms > 0) {
@@ -70,7 +116,10 @@ std::optional<ssize_t> IO::doIO(int fd, IOEvent event, Func &&op, bool use_et, i
 
         // LOG_INFO("fd:{} is checking timeout", fd);
 
-        if (timeout_state->load(std::memory_order_acquire)) {
+        if (timeout_state->load(std::memory_order_acquire) || (current && current->IsDeadlineExceeded())) {
+            if (timer && !woken_state->exchange(true, std::memory_order_acq_rel)) {
+                timer_wheel.cancel(timer);
+            }
             errno = ETIMEDOUT;
             // LOG_INFO("fd:{} Get IO Timeout, return", fd);
             return std::nullopt;
@@ -143,6 +192,47 @@ std::optional<ssize_t> IO::write(int fd, const void *buffer, size_t len, int64_t
     return doIO(fd, IOEvent::WRITE, [fd, buffer, len]() { return ::write(fd, buffer, len); }, false, timeout_ms);
 }
 
+std::optional<IOBuffer> IO::read_any(int fd, int64_t timeout_ms) {
+    setNonBlocking(fd);
+    auto current = Fiber::GetCurrentFiberPtr();
+    timeout_ms = capTimeoutToDeadline(current.get(), timeout_ms);
+
+    auto &ring = Scheduler::getThreadLocalBufferRing();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max<int64_t>(timeout_ms, 0));
+    if (ring.usesUring()) {
+        auto buffer = ring.read(fd, timeout_ms);
+        // 环里的缓冲区都在使用中时退回到epoll路径
+        if (buffer || errno != ENOBUFS) {
+            return buffer;
+        }
+    }
+
+    // 先等可读再取缓冲区，阻塞中的连接不占用缓冲区
+    while (true) {
+        int64_t wait_ms = timeout_ms;
+        if (timeout_ms >= 0) {
+            auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            wait_ms = std::max<int64_t>(remaining.count(), 0);
+        }
+        if (!wait(fd, POLLIN, wait_ms)) {
+            return std::nullopt;
+        }
+
+        IOBuffer buffer = ring.acquire();
+        ssize_t n = ::read(fd, buffer.data(), ring.bufferSize());
+        if (n >= 0) {
+            if (n == 0) {
+                return IOBuffer();
+            }
+            BufferRing::resize(buffer, static_cast<size_t>(n));
+            return buffer;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return std::nullopt;
+        }
+    }
+}
+
 std::optional<int> IO::accept(int sockfd, sockaddr *addr, socklen_t *addrlen, int64_t timeout_ms) {
     setNonBlocking(sockfd);
     // LOG_DEBUG("[fiber::IO] Calling accept by fd={}", sockfd);
@@ -153,6 +243,7 @@ std::optional<int> IO::accept(int sockfd, sockaddr *addr, socklen_t *addrlen, in
     if (result) {
         int client_fd = static_cast<int>(*result);
         setNonBlocking(client_fd); // 新连接的fd也设置为非阻塞
+        applyBusyPoll(client_fd);
         return client_fd;
     }
     return std::nullopt;
@@ -188,11 +279,15 @@ std::vector<int> IO::accept_et(int sockfd, sockaddr *addr, socklen_t *addrlen, i
             true,
             timeout_ms);
 
+    for (int client_fd: recvd_fds) {
+        applyBusyPoll(client_fd);
+    }
     return recvd_fds;
 }
 
 bool IO::connect(int sockfd, const sockaddr *addr, socklen_t addrlen, int64_t timeout_ms) {
     setNonBlocking(sockfd);
+    applyBusyPoll(sockfd);
     // LOG_DEBUG("[fiber::IO] Calling connect by fd={}", sockfd);
     int ret = ::connect(sockfd, addr, addrlen);
     if (ret == 0) {
@@ -394,4 +489,107 @@ int IO::shutdown(int fd, int how) {
     return ::shutdown(fd, how); // 非阻塞调用
 }
 
+std::optional<short> IO::wait(int fd, short events, int64_t timeout_ms) {
+    pollfd pfd{fd, events, 0};
+    auto n = poll(std::span<pollfd>(&pfd, 1), timeout_ms);
+    if (!n) {
+        return std::nullopt;
+    }
+    return pfd.revents;
+}
+
+std::optional<int> IO::poll(std::span<pollfd> fds, int64_t timeout_ms) {
+    if (!Fiber::InSchedulableFiber()) {
+        // 外部线程直接阻塞在poll上
+        int n = ::poll(fds.data(), fds.size(), timeout_ms < 0 ? -1 : static_cast<int>(timeout_ms));
+        if (n == 0) {
+            errno = ETIMEDOUT;
+            return std::nullopt;
+        }
+        return n < 0 ? std::nullopt : std::optional<int>(n);
+    }
+
+    auto &io_manager = Scheduler::getThreadLocalIOManager();
+    auto &timer_wheel = Scheduler::getThreadLocalTimerManager();
+
+    auto current = Fiber::GetCurrentFiberPtr();
+    if (timeout_ms != 0) {
+        timeout_ms = capTimeoutToDeadline(current.get(), timeout_ms);
+    }
+
+    // 定时器和fiber在同一个consumer线程上执行，pending只在本线程读写
+    auto timed_out = std::make_shared<bool>(false);
+    auto pending = std::make_shared<WaitQueue::WaitTicket>();
+    TimerWheel::TimerPtr timer;
+    if (timeout_ms > 0) {
+        timer = timer_wheel.addTimer(
+                static_cast<uint64_t>(timeout_ms),
+                [timed_out, pending]() {
+                    *timed_out = true;
+                    if (pending->claimed) {
+                        WaitQueue::notify(*pending);
+                    }
+                },
+                false);
+    }
+
+    std::vector<std::pair<int, IOEvent>> registered;
+    registered.reserve(fds.size());
+    // 每个fd上只撤销自己的那一份登记，同一个fd上的doIO或其他poll照常等待
+    auto unregister = [&]() {
+        for (auto &[fd, event]: registered) {
+            io_manager.delEvent(fd, event, false);
+        }
+        registered.clear();
+    };
+    auto finish = [&]() {
+        if (timer) {
+            timer_wheel.cancel(timer);
+        }
+    };
+
+    while (true) {
+        // 就绪状态统一由poll计算，epoll只负责唤醒；regular file等epoll不支持的fd在这里直接就绪
+        int n = ::poll(fds.data(), fds.size(), 0);
+        if (n != 0) {
+            finish();
+            return n < 0 ? std::nullopt : std::optional<int>(n);
+        }
+
+        if (timeout_ms == 0 || *timed_out || current->IsDeadlineExceeded()) {
+            finish();
+            errno = ETIMEDOUT;
+            return std::nullopt;
+        }
+
+        // 同一个凭据挂到所有fd的等待队列上，任意一个fd就绪（或超时）只唤醒一次
+        *pending = WaitQueue::make_ticket();
+        for (auto &pfd: fds) {
+            if (pfd.fd < 0) {
+                continue;
+            }
+            uint32_t events = static_cast<uint32_t>(pfd.events) & (EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLRDHUP);
+            // 只关心错误和挂断时（events为0）也要登记，否则出错或挂断后要一直睡到超时；
+            // epoll总会报告这两位，就绪时唤醒读等待队列
+            if (events == 0) {
+                events = EPOLLERR | EPOLLHUP;
+            }
+            auto event = static_cast<IOEvent>(events);
+            if (!io_manager.addWaiter(pfd.fd, event, *pending)) {
+                int saved_errno = errno;
+                WaitQueue::cancel_wait(*pending);
+                unregister();
+                finish();
+                errno = saved_errno;
+                return std::nullopt;
+            }
+            registered.emplace_back(pfd.fd, event);
+        }
+
+        WaitQueue::commit_wait(*pending);
+        *pending = {};
+        unregister();
+    }
+}
+
 } // namespace fiber
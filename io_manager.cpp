@@ -1,7 +1,11 @@
 #include "io_manager.h"
+#include <cerrno>
 #include <cstring>
 #include <unistd.h>
 #include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include "fiber_log.h"
+#include "probes.h"
 
 #include "serika/basic/logger.h"
 
@@ -55,8 +59,15 @@ void IOManager::init() {
         throw std::runtime_error("Failed to add eventfd");
     }
 
+#ifdef SYS_epoll_pwait2
+    // 用零超时探测一次，老内核返回ENOSYS时退回毫秒精度的epoll_wait
+    epoll_event probe;
+    timespec zero{};
+    precise_wait_ = ::syscall(SYS_epoll_pwait2, epoll_fd_, &probe, 1, &zero, nullptr, 0) >= 0 || errno != ENOSYS;
+#endif
+
     running_.store(true, std::memory_order_release);
-    LOG_DEBUG("IOManager initialized (epoll_fd={})", epoll_fd_);
+    LOG_DEBUG("IOManager initialized (epoll_fd={}, epoll_pwait2={})", epoll_fd_, precise_wait_);
 }
 
 void IOManager::shutdown() {
@@ -79,6 +90,34 @@ void IOManager::wakeUpEpoll() {
     }
 }
 
+void IOManager::FdContext::retain(uint32_t mask) {
+    for (uint32_t bits = mask; bits; bits &= bits - 1) {
+        ++waiter_counts[__builtin_ctz(bits)];
+    }
+    events |= mask;
+}
+
+uint32_t IOManager::FdContext::remainingAfter(uint32_t mask) const {
+    uint32_t remaining = 0;
+    for (uint32_t bits = events; bits; bits &= bits - 1) {
+        int bit = __builtin_ctz(bits);
+        if (waiter_counts[bit] > ((mask >> bit) & 1U)) {
+            remaining |= 1U << bit;
+        }
+    }
+    return remaining;
+}
+
+void IOManager::FdContext::release(uint32_t mask) {
+    for (uint32_t bits = mask; bits; bits &= bits - 1) {
+        auto &count = waiter_counts[__builtin_ctz(bits)];
+        if (count > 0) {
+            --count;
+        }
+    }
+    events = remainingAfter(0);
+}
+
 // atomic
 IOManager::FdContextPtr IOManager::getOrCreateFdContext(int fd) {
     // 现在不需要任何并发保护，IOManager单线程内运行
@@ -104,6 +143,7 @@ bool IOManager::addEvent(int fd, IOEvent event, bool use_et) {
     if (!running_.load(std::memory_order_acquire)) {
         return false;
     }
+    FIBER_PROBE2(io_add, fd, static_cast<uint32_t>(event));
 
     // LOG_DEBUG("[IOManager] Add Events, fd:{}, getting latch", fd);
     auto ctx = getOrCreateFdContext(fd);
@@ -111,7 +151,7 @@ bool IOManager::addEvent(int fd, IOEvent event, bool use_et) {
 
     uint32_t old_events = ctx->events;
     uint32_t new_events = old_events | static_cast<uint32_t>(event);
-    LOG_DEBUG("[IOManager] Add Events, fd:{}, old_events={}, new_events={}", fd, old_events, new_events);
+    FIBER_LOG_DEBUG("[IOManager] Add Events, fd:{}, old_events={}, new_events={}", fd, old_events, new_events);
 
     epoll_event ep_event;
     memset(&ep_event, 0, sizeof(ep_event));
@@ -124,15 +164,18 @@ bool IOManager::addEvent(int fd, IOEvent event, bool use_et) {
     // 有可能一种竞态条件导致事件丢失，在注册epoll事件后，到开始阻塞前，触发了epoll
     // 所以这里要拿住fd_mutex
 
+    // 同一个fd上可能已经有IO::poll的等待者，这时合并事件
     int op = old_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    assert(op == EPOLL_CTL_ADD && "Invalid Op");
     int ret = epoll_ctl(epoll_fd_, op, fd, &ep_event);
     if (ret < 0) {
         LOG_ERROR("[addEvent] epoll_ctl failed: fd={}, op={}, error={}", fd, op, strerror(errno));
+        if (old_events == 0) {
+            fd_contexts_.erase(fd);
+        }
         return false;
     }
 
-    ctx->events = new_events;
+    ctx->retain(static_cast<uint32_t>(event));
 
     auto current_fiber = Fiber::GetCurrentFiberPtr();
     assert(current_fiber && "IO operations must be called from within a fiber");
@@ -147,6 +190,45 @@ bool IOManager::addEvent(int fd, IOEvent event, bool use_et) {
     return true;
 }
 
+bool IOManager::addWaiter(int fd, IOEvent event, const WaitQueue::WaitTicket &ticket) {
+    if (!running_.load(std::memory_order_acquire)) {
+        errno = ESHUTDOWN;
+        return false;
+    }
+
+    auto ctx = getOrCreateFdContext(fd);
+
+    uint32_t events = static_cast<uint32_t>(event);
+    uint32_t old_events = ctx->events;
+    uint32_t new_events = old_events | events;
+
+    epoll_event ep_event;
+    memset(&ep_event, 0, sizeof(ep_event));
+    ep_event.events = new_events | EPOLLONESHOT;
+    ep_event.data.fd = fd;
+
+    // 与doIO不同，允许和其他等待者共享同一个fd，已注册时合并事件
+    int op = old_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(epoll_fd_, op, fd, &ep_event) < 0) {
+        LOG_ERROR("[addWaiter] epoll_ctl failed: fd={}, op={}, error={}", fd, op, strerror(errno));
+        if (old_events == 0) {
+            fd_contexts_.erase(fd);
+        }
+        return false;
+    }
+
+    ctx->retain(events);
+
+    if (events & ~static_cast<uint32_t>(EPOLLOUT)) {
+        ctx->read_waiters->prepare_wait(ticket);
+    }
+    if (events & EPOLLOUT) {
+        ctx->write_waiters->prepare_wait(ticket);
+    }
+
+    return true;
+}
+
 bool IOManager::delEvent(int fd, IOEvent event, bool use_et) {
     if (!running_.load(std::memory_order_acquire)) {
         return false;
@@ -160,13 +242,15 @@ bool IOManager::delEvent(int fd, IOEvent event, bool use_et) {
 
     auto ctx = fd_contexts_.at(fd);
 
+    // 只去掉调用方自己的那一份，其他等待者还需要的位保留
     uint32_t old_events = ctx->events;
-    uint32_t new_events = old_events & ~static_cast<uint32_t>(event);
-    LOG_DEBUG("[IOManager] Del Event, fd={}, old_events={}, new_events={}", fd, old_events, new_events);
+    uint32_t new_events = ctx->remainingAfter(static_cast<uint32_t>(event));
+    FIBER_LOG_DEBUG("[IOManager] Del Event, fd={}, old_events={}, new_events={}", fd, old_events, new_events);
 
     epoll_event ep_event;
     memset(&ep_event, 0, sizeof(ep_event));
-    ep_event.events = new_events;
+    // 剩下的等待者可能是因为ONESHOT已经触发过而没有再被监听，这里重新装上
+    ep_event.events = new_events ? new_events | EPOLLONESHOT : 0;
     if (use_et) {
         ep_event.events |= EPOLLET;
     }
@@ -174,22 +258,60 @@ bool IOManager::delEvent(int fd, IOEvent event, bool use_et) {
 
     int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
     int ret = epoll_ctl(epoll_fd_, op, fd, &ep_event);
+    ctx->release(static_cast<uint32_t>(event));
     if (ret < 0) {
+        // fd已经被关闭时内核会自动移除注册，等待计数照样要减掉
         LOG_ERROR("[delEvent] epoll_ctl failed: fd={}, op={}, error={}", fd, op, strerror(errno));
+        if (ctx->events == 0) {
+            fd_contexts_.erase(fd);
+        }
         return false;
     }
 
-    ctx->events = new_events;
-
     if (new_events == 0) {
         fd_contexts_.erase(fd);
     } else {
-        LOG_DEBUG("Delevent remaining");
+        FIBER_LOG_DEBUG("Delevent remaining");
     }
 
     return true;
 }
 
+bool IOManager::addWatch(int fd, uint32_t events, IOCallback cb) {
+    if (!running_.load(std::memory_order_acquire)) {
+        errno = ESHUTDOWN;
+        return false;
+    }
+
+    epoll_event ep_event;
+    memset(&ep_event, 0, sizeof(ep_event));
+    ep_event.events = events;
+    ep_event.data.fd = fd;
+
+    int op = watches_.contains(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(epoll_fd_, op, fd, &ep_event) < 0) {
+        LOG_ERROR("[addWatch] epoll_ctl failed: fd={}, op={}, error={}", fd, op, strerror(errno));
+        return false;
+    }
+
+    watches_[fd] = std::move(cb);
+    return true;
+}
+
+bool IOManager::removeWatch(int fd) {
+    auto it = watches_.find(fd);
+    if (it == watches_.end()) {
+        return false;
+    }
+    watches_.erase(it);
+
+    if (epoll_fd_ >= 0 && epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr) < 0) {
+        LOG_ERROR("[removeWatch] epoll_ctl failed: fd={}, error={}", fd, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
 // TODO cancel
 // event不应该通知吧？想想通知的场景，应该是超时了才会触发，不超时提前取消说明已经不阻塞了
 bool IOManager::wakeUp(int fd, IOEvent event) {
@@ -218,6 +340,12 @@ bool IOManager::handleFd(int fd, uint32_t revents) {
     if (fd == wakeup_fd_) {
         return true;
     }
+    FIBER_PROBE2(io_ready, fd, revents);
+
+    if (auto it = watches_.find(fd); it != watches_.end()) {
+        it->second();
+        return true;
+    }
 
     if (!fd_contexts_.contains(fd)) {
         LOG_WARN("fd:{} cannot find fd context, event may have lost", fd);
@@ -226,7 +354,7 @@ bool IOManager::handleFd(int fd, uint32_t revents) {
 
     auto ctx = fd_contexts_.at(fd);
 
-    if (revents & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+    if (revents & (EPOLLIN | EPOLLPRI | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
         // LOG_INFO("Waking up a reader:{}", fd);
         ctx->read_waiters->notify_all();
     }
@@ -238,9 +366,9 @@ bool IOManager::handleFd(int fd, uint32_t revents) {
     return true;
 }
 
-void IOManager::processEvents(int timeout_ms) {
+int IOManager::processEvents(int timeout_ms) {
     if (!running_.load(std::memory_order_acquire)) {
-        return;
+        return 0;
     }
 
     constexpr int MAX_EVENTS = 1024;
@@ -251,16 +379,49 @@ void IOManager::processEvents(int timeout_ms) {
         if (errno != EINTR) {
             LOG_ERROR("epoll_wait failed: {}", strerror(errno));
         }
-        return;
+        return 0;
     }
 
-    std::queue<std::pair<int, uint32_t>> remains;
-    for (int i = 0; i < n; ++i) {
-        int fd = events[i].data.fd;
-        uint32_t revents = events[i].events;
+    handleEvents(events, n);
+    return n;
+}
 
-        handleFd(fd, revents);
+int IOManager::processEvents(std::chrono::nanoseconds timeout) {
+    if (!precise_wait_) {
+        // 向上取整，宁可晚一点醒，也不要提前醒来后空转
+        return processEvents(static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(timeout).count()));
+    }
 
+#ifdef SYS_epoll_pwait2
+    if (!running_.load(std::memory_order_acquire)) {
+        return 0;
+    }
+
+    constexpr int MAX_EVENTS = 1024;
+    epoll_event events[MAX_EVENTS];
+
+    timespec ts{};
+    ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+    ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+
+    int n = static_cast<int>(::syscall(SYS_epoll_pwait2, epoll_fd_, events, MAX_EVENTS, &ts, nullptr, 0));
+    if (n < 0) {
+        if (errno != EINTR) {
+            LOG_ERROR("epoll_pwait2 failed: {}", strerror(errno));
+        }
+        return 0;
+    }
+
+    handleEvents(events, n);
+    return n;
+#else
+    return 0;
+#endif
+}
+
+void IOManager::handleEvents(const epoll_event *events, int n) {
+    for (int i = 0; i < n; ++i) {
+        handleFd(events[i].data.fd, events[i].events);
     }
 }
 
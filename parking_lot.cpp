@@ -0,0 +1,225 @@
+#include "parking_lot.h"
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include "fiber.h"
+#include "fiber_consumer.h"
+#include "scheduler.h"
+#include "sync.h"
+#include "timer.h"
+#include "wait_queue.h"
+
+namespace fiber {
+
+namespace {
+
+// 等待者节点，放在等待者自己的栈上，只在桶锁内访问；被摘下之后归摘下它的一方负责唤醒
+struct ParkNode {
+    const void *addr{nullptr};
+    Fiber::ptr fiber;
+    std::shared_ptr<ThreadParker> parker;
+    ParkNode *prev{nullptr};
+    ParkNode *next{nullptr};
+    bool linked{false};
+    bool timed_out{false};
+};
+
+struct alignas(CACHE_LINE_SIZE) Bucket {
+    SpinLock lock;
+    std::atomic<uint32_t> waiters{0}; // notify时没有等待者就不拿锁
+    ParkNode *head{nullptr};
+    ParkNode *tail{nullptr};
+
+    void link(ParkNode *node) {
+        node->prev = tail;
+        node->next = nullptr;
+        if (tail) {
+            tail->next = node;
+        } else {
+            head = node;
+        }
+        tail = node;
+        node->linked = true;
+    }
+
+    void unlink(ParkNode *node) {
+        if (node->prev) {
+            node->prev->next = node->next;
+        } else {
+            head = node->next;
+        }
+        if (node->next) {
+            node->next->prev = node->prev;
+        } else {
+            tail = node->prev;
+        }
+        node->linked = false;
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+};
+
+constexpr size_t kBucketBits = 10;
+Bucket g_buckets[1 << kBucketBits];
+
+Bucket &bucketFor(const void *addr) {
+    auto hash = reinterpret_cast<uintptr_t>(addr);
+    hash ^= hash >> 17;
+    hash *= 0x9E3779B97F4A7C15ull;
+    return g_buckets[hash >> (64 - kBucketBits)];
+}
+
+void wake(Fiber::ptr &fiber, std::shared_ptr<ThreadParker> &parker) {
+    if (parker) {
+        parker->unpark();
+        return;
+    }
+    auto &&scheduler = Scheduler::getInst();
+    scheduler.scheduleImmediate(fiber);
+}
+
+} // namespace
+
+bool parking_lot::park(const void *addr, Validate validate, const void *context, int64_t timeout_ms) {
+    const bool in_fiber = Fiber::InSchedulableFiber();
+    if (!in_fiber) {
+        if (FiberConsumer::current()) {
+            std::cerr << "ERROR: wait_on() called from consumer scheduling loop" << std::endl;
+            throw std::runtime_error("wait_on() must be called from within a fiber or a non-consumer thread");
+        }
+        if (timeout_ms > 0) {
+            throw std::runtime_error("wait_on() with timeout must be called from within a fiber");
+        }
+    }
+
+    // 挂起点：deadline已过的fiber不再挂起，直接取消
+    Fiber::CheckDeadline();
+
+    if (timeout_ms == 0) {
+        return !validate(context);
+    }
+
+    ParkNode node;
+    node.addr = addr;
+    if (in_fiber) {
+        node.fiber = Fiber::GetCurrentFiberPtr();
+    } else {
+        node.parker = ThreadParker::current();
+    }
+
+    Bucket &bucket = bucketFor(addr);
+    {
+        std::lock_guard<SpinLock> guard(bucket.lock);
+        bucket.waiters.fetch_add(1, std::memory_order_relaxed);
+        // 与notify一侧的fence配对：要么notify看到waiters，要么这里看到新值
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!validate(context)) {
+            bucket.waiters.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        bucket.link(&node);
+    }
+
+    TimerWheel::TimerPtr timer;
+    if (timeout_ms > 0) {
+        // 定时器和fiber在同一个consumer线程上执行，fiber恢复并取消定时器之前node一直有效
+        timer = Scheduler::getThreadLocalTimerManager().addTimer(
+                static_cast<uint64_t>(timeout_ms),
+                [&bucket, node_ptr = &node]() {
+                    Fiber::ptr fiber;
+                    {
+                        std::lock_guard<SpinLock> guard(bucket.lock);
+                        if (!node_ptr->linked) {
+                            return; // 已经被notify摘走
+                        }
+                        bucket.unlink(node_ptr);
+                        node_ptr->timed_out = true;
+                        fiber = std::move(node_ptr->fiber);
+                    }
+                    auto &&scheduler = Scheduler::getInst();
+                    scheduler.scheduleImmediate(fiber);
+                },
+                false);
+    }
+
+    if (in_fiber) {
+        // notify可能已经把fiber投递回运行队列，fiber绑定了本consumer，只会在这次block_yield之后才被resume
+        Fiber::block_yield();
+    } else {
+        node.parker->park();
+    }
+
+    if (timer) {
+        Scheduler::getThreadLocalTimerManager().cancel(timer);
+    }
+    return !node.timed_out;
+}
+
+bool notify_one(const void *addr) {
+    Bucket &bucket = bucketFor(addr);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (bucket.waiters.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+
+    Fiber::ptr fiber;
+    std::shared_ptr<ThreadParker> parker;
+    {
+        std::lock_guard<SpinLock> guard(bucket.lock);
+        ParkNode *node = bucket.head;
+        while (node && node->addr != addr) {
+            node = node->next;
+        }
+        if (!node) {
+            return false;
+        }
+        bucket.unlink(node);
+        fiber = std::move(node->fiber);
+        parker = std::move(node->parker);
+    }
+
+    wake(fiber, parker);
+    return true;
+}
+
+size_t notify_all(const void *addr) {
+    Bucket &bucket = bucketFor(addr);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (bucket.waiters.load(std::memory_order_relaxed) == 0) {
+        return 0;
+    }
+
+    // 摘下来的节点串成私有链表，出锁后再唤醒；节点在其等待者被唤醒前一直有效
+    ParkNode *woken = nullptr;
+    {
+        std::lock_guard<SpinLock> guard(bucket.lock);
+        ParkNode *node = bucket.head;
+        ParkNode *woken_tail = nullptr;
+        while (node) {
+            ParkNode *next = node->next;
+            if (node->addr == addr) {
+                bucket.unlink(node);
+                node->next = nullptr;
+                if (woken_tail) {
+                    woken_tail->next = node;
+                } else {
+                    woken = node;
+                }
+                woken_tail = node;
+            }
+            node = next;
+        }
+    }
+
+    size_t count = 0;
+    while (woken) {
+        ParkNode *next = woken->next;
+        Fiber::ptr fiber = std::move(woken->fiber);
+        std::shared_ptr<ThreadParker> parker = std::move(woken->parker);
+        wake(fiber, parker);
+        woken = next;
+        ++count;
+    }
+    return count;
+}
+
+} // namespace fiber
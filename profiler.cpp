@@ -0,0 +1,436 @@
+#include "profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <string>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "fiber.h"
+#include "serika/basic/logger.h"
+#include "sync.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+namespace fiber::profiler {
+
+namespace {
+
+constexpr size_t kMaxDepth = 64;
+constexpr uintptr_t kMaxFrameSize = 1 << 20; // 相邻两帧的帧指针相差超过这个值时认为回溯已经出错
+
+// 一个样本，seq为奇数表示正在写入（seqlock），读者校验前后两次seq一致才采用
+struct Sample {
+    std::atomic<uint64_t> seq{0};
+    uint64_t fiber_id{0};
+    uint64_t trace_id{0};
+    uint32_t depth{0};
+    uintptr_t pcs[kMaxDepth]{};
+};
+
+// 每个consumer一个：只有该consumer线程的信号处理函数写入，dump时其他线程读取
+struct alignas(CACHE_LINE_SIZE) ConsumerSlot {
+    std::atomic<Sample *> samples{nullptr};
+    size_t mask{0};
+    std::atomic<uint64_t> head{0}; // 已写入的样本总数
+    std::atomic<uint64_t> base{0}; // reset时的head，dump只读取之后的样本
+
+    // 以下字段由g_mutex保护
+    bool online{false};
+    pthread_t thread{};
+    pid_t tid{0};
+    bool armed{false};
+    timer_t timer{};
+};
+
+std::mutex g_mutex;
+std::unique_ptr<ConsumerSlot[]> g_slots;
+size_t g_slot_count{0};
+std::atomic<bool> g_running{false};
+int g_hz{99};
+size_t g_capacity{8192}; // 每个consumer环的容量，start时确定
+bool g_handler_installed{false};
+bool g_safe_read{false}; // process_vm_readv可用时，回溯栈帧不会因为错误的帧指针而SIGSEGV
+pid_t g_pid{0};
+
+thread_local ConsumerSlot *tls_slot = nullptr;
+
+bool readFrame(uintptr_t fp, uintptr_t frame[2]) {
+    if (!g_safe_read) {
+        std::memcpy(frame, reinterpret_cast<const void *>(fp), 2 * sizeof(uintptr_t));
+        return true;
+    }
+    iovec local{frame, 2 * sizeof(uintptr_t)};
+    iovec remote{reinterpret_cast<void *>(fp), 2 * sizeof(uintptr_t)};
+    return ::process_vm_readv(g_pid, &local, 1, &remote, 1, 0) == static_cast<ssize_t>(2 * sizeof(uintptr_t));
+}
+
+// 信号处理函数，只使用异步信号安全的操作
+void onProfileSignal(int, siginfo_t *, void *context) {
+    ConsumerSlot *slot = tls_slot;
+    if (!slot || !g_running.load(std::memory_order_relaxed)) {
+        return;
+    }
+    Sample *samples = slot->samples.load(std::memory_order_acquire);
+    if (!samples) {
+        return;
+    }
+    int saved_errno = errno;
+
+    uintptr_t pc = 0;
+    uintptr_t fp = 0;
+    uintptr_t sp = 0;
+    auto *uc = static_cast<ucontext_t *>(context);
+#if defined(__x86_64__)
+    pc = static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RIP]);
+    fp = static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RBP]);
+    sp = static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RSP]);
+#elif defined(__aarch64__)
+    pc = static_cast<uintptr_t>(uc->uc_mcontext.pc);
+    fp = static_cast<uintptr_t>(uc->uc_mcontext.regs[29]);
+    sp = static_cast<uintptr_t>(uc->uc_mcontext.sp);
+#else
+    (void) uc;
+#endif
+
+    uint64_t index = slot->head.load(std::memory_order_relaxed);
+    Sample &sample = samples[index & slot->mask];
+    sample.seq.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    Fiber *fiber = Fiber::GetCurrentFiberRaw();
+    sample.fiber_id = fiber ? fiber->getId() : 0;
+    sample.trace_id = fiber ? fiber->GetTraceId() : 0;
+
+    uint32_t depth = 0;
+    if (pc) {
+        sample.pcs[depth++] = pc;
+    }
+    // 帧指针必须对齐、在栈顶之上并且逐帧递增
+    while (depth < kMaxDepth && fp && (fp & (sizeof(uintptr_t) - 1)) == 0 && fp >= sp) {
+        uintptr_t frame[2];
+        if (!readFrame(fp, frame) || frame[1] == 0) {
+            break;
+        }
+        sample.pcs[depth++] = frame[1];
+        if (frame[0] <= fp || frame[0] - fp > kMaxFrameSize) {
+            break;
+        }
+        fp = frame[0];
+    }
+    sample.depth = depth;
+
+    sample.seq.store(2 * index + 2, std::memory_order_release);
+    slot->head.store(index + 1, std::memory_order_release);
+    errno = saved_errno;
+}
+
+bool installHandler() {
+    if (g_handler_installed) {
+        return true;
+    }
+    // 一旦安装就不再恢复：停止后仍可能有排队中的SIGPROF，默认动作会终止进程
+    struct sigaction action{};
+    action.sa_sigaction = onProfileSignal;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (::sigaction(SIGPROF, &action, nullptr) < 0) {
+        LOG_ERROR("[profiler] sigaction(SIGPROF) failed: {}", strerror(errno));
+        return false;
+    }
+    g_handler_installed = true;
+    return true;
+}
+
+// 调用方持有g_mutex，容量变化时换新环，否则从当前位置开始记录
+void prepareRing(ConsumerSlot &slot) {
+    Sample *old = slot.samples.load(std::memory_order_relaxed);
+    if (!old || slot.mask + 1 != g_capacity) {
+        // 环只在停止采样时替换，旧环不释放：仍可能有排队中的信号在写入
+        slot.samples.store(nullptr, std::memory_order_release);
+        slot.mask = g_capacity - 1;
+        slot.head.store(0, std::memory_order_relaxed);
+        slot.base.store(0, std::memory_order_relaxed);
+        slot.samples.store(new Sample[g_capacity], std::memory_order_release);
+    } else {
+        slot.base.store(slot.head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+// 调用方持有g_mutex
+bool arm(ConsumerSlot &slot) {
+    if (slot.armed || !slot.online) {
+        return true;
+    }
+
+    clockid_t clock;
+    if (int err = pthread_getcpuclockid(slot.thread, &clock); err != 0) {
+        LOG_ERROR("[profiler] pthread_getcpuclockid failed: {}", strerror(err));
+        return false;
+    }
+
+    sigevent event{};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = slot.tid;
+    if (::timer_create(clock, &event, &slot.timer) < 0) {
+        LOG_ERROR("[profiler] timer_create failed: {}", strerror(errno));
+        return false;
+    }
+
+    long interval_ns = 1000000000L / g_hz;
+    itimerspec spec{};
+    spec.it_interval.tv_sec = interval_ns / 1000000000L;
+    spec.it_interval.tv_nsec = interval_ns % 1000000000L;
+    spec.it_value = spec.it_interval;
+    if (::timer_settime(slot.timer, 0, &spec, nullptr) < 0) {
+        LOG_ERROR("[profiler] timer_settime failed: {}", strerror(errno));
+        ::timer_delete(slot.timer);
+        return false;
+    }
+    slot.armed = true;
+    return true;
+}
+
+// 调用方持有g_mutex
+void disarm(ConsumerSlot &slot) {
+    if (slot.armed) {
+        ::timer_delete(slot.timer);
+        slot.armed = false;
+    }
+}
+
+struct Stack {
+    uint64_t fiber_id;
+    uint64_t trace_id;
+    std::vector<uintptr_t> pcs;
+};
+
+// 读取所有consumer环中的有效样本，跳过正在写入或已被覆盖的样本
+std::vector<Stack> collect() {
+    std::vector<Stack> stacks;
+    std::lock_guard<std::mutex> guard(g_mutex);
+    for (size_t i = 0; i < g_slot_count; ++i) {
+        ConsumerSlot &slot = g_slots[i];
+        Sample *samples = slot.samples.load(std::memory_order_acquire);
+        if (!samples) {
+            continue;
+        }
+        uint64_t head = slot.head.load(std::memory_order_acquire);
+        uint64_t capacity = slot.mask + 1;
+        uint64_t begin = std::max(slot.base.load(std::memory_order_relaxed), head > capacity ? head - capacity : 0);
+        for (uint64_t index = begin; index < head; ++index) {
+            const Sample &sample = samples[index & slot.mask];
+            uint64_t seq = sample.seq.load(std::memory_order_acquire);
+            Stack stack{sample.fiber_id, sample.trace_id,
+                        std::vector<uintptr_t>(sample.pcs, sample.pcs + std::min<uint32_t>(sample.depth, kMaxDepth))};
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq != 2 * index + 2 || sample.seq.load(std::memory_order_relaxed) != seq || stack.pcs.empty()) {
+                continue;
+            }
+            stacks.push_back(std::move(stack));
+        }
+    }
+    return stacks;
+}
+
+std::string symbolize(uintptr_t pc, bool leaf, std::unordered_map<uintptr_t, std::string> &cache) {
+    if (auto it = cache.find(pc); it != cache.end()) {
+        return it->second;
+    }
+
+    // 返回地址指向call的下一条指令，减1才落在调用者内部
+    uintptr_t lookup = leaf ? pc : pc - 1;
+    std::string name;
+    Dl_info info{};
+    if (::dladdr(reinterpret_cast<void *>(lookup), &info) && info.dli_sname) {
+        int status = 0;
+        char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        name = status == 0 && demangled ? demangled : info.dli_sname;
+        std::free(demangled);
+    } else if (info.dli_fname) {
+        const char *module = std::strrchr(info.dli_fname, '/');
+        char offset[32];
+        std::snprintf(offset, sizeof(offset), "+0x%zx", lookup - reinterpret_cast<uintptr_t>(info.dli_fbase));
+        name = std::string(module ? module + 1 : info.dli_fname) + offset;
+    } else {
+        char address[32];
+        std::snprintf(address, sizeof(address), "0x%zx", lookup);
+        name = address;
+    }
+    // 折叠栈格式用';'分隔帧、用空格分隔次数
+    std::replace(name.begin(), name.end(), ';', ':');
+    return cache.emplace(pc, std::move(name)).first->second;
+}
+
+} // namespace
+
+bool start(int hz, size_t samples_per_consumer) {
+    std::lock_guard<std::mutex> guard(g_mutex);
+    if (g_running.load(std::memory_order_acquire)) {
+        return false;
+    }
+    if (hz <= 0 || !installHandler()) {
+        return false;
+    }
+    g_hz = hz;
+
+    // 探测一次process_vm_readv，seccomp禁用时退回直接读内存
+    g_pid = ::getpid();
+    uintptr_t probe[2] = {1, 2};
+    uintptr_t copy[2];
+    iovec local{copy, sizeof(copy)};
+    iovec remote{probe, sizeof(probe)};
+    g_safe_read = ::process_vm_readv(g_pid, &local, 1, &remote, 1, 0) == static_cast<ssize_t>(sizeof(probe));
+
+    // 调度器还没有启动时没有采样槽，attachConsumers时再按这里的容量分配
+    g_capacity = std::bit_ceil(std::max<size_t>(samples_per_consumer, 1));
+    for (size_t i = 0; i < g_slot_count; ++i) {
+        prepareRing(g_slots[i]);
+    }
+
+    g_running.store(true, std::memory_order_release);
+    bool ok = true;
+    for (size_t i = 0; i < g_slot_count; ++i) {
+        ok = arm(g_slots[i]) && ok;
+    }
+    if (g_slot_count == 0) {
+        LOG_INFO("[profiler] started at {} Hz, sampling begins when the scheduler starts its consumers", hz);
+    } else {
+        LOG_INFO("[profiler] started at {} Hz on {} consumers", hz, g_slot_count);
+    }
+    return ok;
+}
+
+void stop() {
+    std::lock_guard<std::mutex> guard(g_mutex);
+    g_running.store(false, std::memory_order_release);
+    for (size_t i = 0; i < g_slot_count; ++i) {
+        disarm(g_slots[i]);
+    }
+}
+
+bool running() { return g_running.load(std::memory_order_acquire); }
+
+void reset() {
+    std::lock_guard<std::mutex> guard(g_mutex);
+    for (size_t i = 0; i < g_slot_count; ++i) {
+        g_slots[i].base.store(g_slots[i].head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+size_t sample_count() { return collect().size(); }
+
+void write_folded(std::ostream &out, Label label) {
+    std::unordered_map<uintptr_t, std::string> symbols;
+    std::map<std::string, uint64_t> folded;
+    for (const auto &stack: collect()) {
+        std::string line;
+        if (label == Label::Fiber) {
+            line = "fiber:" + std::to_string(stack.fiber_id) + ";";
+        } else if (label == Label::Trace) {
+            line = "trace:" + std::to_string(stack.trace_id) + ";";
+        }
+        // 样本里栈顶在前，折叠格式栈底在前
+        for (size_t i = stack.pcs.size(); i-- > 0;) {
+            line += symbolize(stack.pcs[i], i == 0, symbols);
+            if (i > 0) {
+                line += ';';
+            }
+        }
+        ++folded[line];
+    }
+    for (const auto &[line, count]: folded) {
+        out << line << ' ' << count << '\n';
+    }
+}
+
+void write_pprof(std::ostream &out) {
+    std::map<std::vector<uintptr_t>, uint64_t> counts;
+    for (auto &stack: collect()) {
+        ++counts[std::move(stack.pcs)];
+    }
+
+    auto word = [&out](uintptr_t value) { out.write(reinterpret_cast<const char *>(&value), sizeof(value)); };
+    // 头部：0, 头部剩余字数3, 版本0, 采样周期（微秒）, 0
+    word(0);
+    word(3);
+    word(0);
+    word(static_cast<uintptr_t>(1000000 / std::max(g_hz, 1)));
+    word(0);
+    for (const auto &[pcs, count]: counts) {
+        word(count);
+        word(pcs.size());
+        for (uintptr_t pc: pcs) {
+            word(pc);
+        }
+    }
+    // 结束标记，后面附上/proc/self/maps供pprof符号化
+    word(0);
+    word(1);
+    word(0);
+    std::ifstream maps("/proc/self/maps");
+    out << maps.rdbuf();
+}
+
+void attachConsumers(int count) {
+    std::lock_guard<std::mutex> guard(g_mutex);
+    if (count <= 0 || static_cast<size_t>(count) <= g_slot_count) {
+        return;
+    }
+    // 只在调度器初始化时分配，之后各consumer的线程本地指针指向这里，不再替换
+    g_slots.reset(new ConsumerSlot[count]);
+    g_slot_count = static_cast<size_t>(count);
+    // 先于调度器调用了start，在这里补上采样环，consumerOnline时就会开始采样
+    if (g_running.load(std::memory_order_acquire)) {
+        for (size_t i = 0; i < g_slot_count; ++i) {
+            prepareRing(g_slots[i]);
+        }
+    }
+}
+
+void consumerOnline(int consumer_id) {
+    std::lock_guard<std::mutex> guard(g_mutex);
+    if (consumer_id < 0 || static_cast<size_t>(consumer_id) >= g_slot_count) {
+        return;
+    }
+    ConsumerSlot &slot = g_slots[consumer_id];
+    slot.online = true;
+    slot.thread = ::pthread_self();
+    slot.tid = static_cast<pid_t>(::syscall(SYS_gettid));
+    tls_slot = &slot;
+    if (g_running.load(std::memory_order_acquire)) {
+        arm(slot);
+    }
+}
+
+void consumerOffline(int consumer_id) {
+    std::lock_guard<std::mutex> guard(g_mutex);
+    if (consumer_id < 0 || static_cast<size_t>(consumer_id) >= g_slot_count) {
+        return;
+    }
+    ConsumerSlot &slot = g_slots[consumer_id];
+    disarm(slot);
+    slot.online = false;
+    tls_slot = nullptr;
+}
+
+} // namespace fiber::profiler
@@ -0,0 +1,165 @@
+#include "rcu.h"
+#include <cassert>
+#include <chrono>
+#include <exception>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "fiber.h"
+#include "fiber_consumer.h"
+#include "serika/basic/logger.h"
+#include "sync.h"
+
+namespace fiber::rcu {
+
+namespace detail {
+thread_local uint32_t read_depth = 0;
+} // namespace detail
+
+namespace {
+
+constexpr uint64_t kOffline = std::numeric_limits<uint64_t>::max();
+
+// 每个consumer最近一次静止点时看到的宽限期序号，独占一个缓存行，只由该consumer写
+struct alignas(CACHE_LINE_SIZE) ConsumerSlot {
+    std::atomic<uint64_t> seq{kOffline};
+};
+
+alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> g_gp_seq{0};
+std::atomic<ConsumerSlot *> g_slots{nullptr};
+std::atomic<size_t> g_slot_count{0};
+
+struct Reclaimer {
+    SpinLock lock;
+    std::vector<std::function<void()>> pending;
+    bool running{false}; // 是否已有回收fiber在处理pending
+};
+
+Reclaimer &reclaimer() {
+    static Reclaimer reclaimer;
+    return reclaimer;
+}
+
+void reclaimLoop() {
+    auto &rec = reclaimer();
+    std::vector<std::function<void()>> batch;
+    while (true) {
+        {
+            std::lock_guard<SpinLock> guard(rec.lock);
+            if (rec.pending.empty()) {
+                rec.running = false;
+                return;
+            }
+            batch.swap(rec.pending);
+        }
+
+        try {
+            synchronize();
+        } catch (...) {
+            // 异常退出也要清掉running，否则之后的call不会再拉起回收fiber；本批回调放回pending等下一次
+            std::lock_guard<SpinLock> guard(rec.lock);
+            rec.pending.insert(rec.pending.begin(), std::make_move_iterator(batch.begin()),
+                               std::make_move_iterator(batch.end()));
+            rec.running = false;
+            throw;
+        }
+        for (auto &callback: batch) {
+            try {
+                callback();
+            } catch (const std::exception &e) {
+                LOG_ERROR("[rcu] callback threw: {}", e.what());
+            } catch (...) {
+                LOG_ERROR("[rcu] callback threw a non-std exception");
+            }
+        }
+        batch.clear();
+    }
+}
+
+} // namespace
+
+void synchronize() {
+    // consumer线程上不在fiber里（定时器、IO watch、HighResTimer回调）时等不到本consumer的静止点，会死锁
+    assert((Fiber::InSchedulableFiber() || !FiberConsumer::current()) &&
+           "rcu::synchronize called from a consumer loop callback, use rcu::call instead");
+    // 旧版本的摘除（assign）先于序号递增，之后经过静止点的consumer不会再读到旧版本
+    const uint64_t target = g_gp_seq.fetch_add(1, std::memory_order_seq_cst) + 1;
+    const size_t count = g_slot_count.load(std::memory_order_acquire);
+    ConsumerSlot *slots = g_slots.load(std::memory_order_acquire);
+
+    const bool in_fiber = Fiber::InSchedulableFiber();
+    for (size_t i = 0; i < count; ++i) {
+        while (true) {
+            uint64_t seq = slots[i].seq.load(std::memory_order_seq_cst);
+            if (seq == kOffline || seq >= target) {
+                break;
+            }
+            // 调度循环每个tick至少迭代一次，宽限期通常在一个tick内结束；
+            // 在fiber中必须真正挂起，让本consumer回到调度循环报告静止点
+            if (in_fiber) {
+                Fiber::sleep(1);
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+}
+
+void call(std::function<void()> callback) {
+    auto &rec = reclaimer();
+    {
+        std::lock_guard<SpinLock> guard(rec.lock);
+        rec.pending.push_back(std::move(callback));
+        if (rec.running) {
+            return;
+        }
+        rec.running = true;
+    }
+    // 回收fiber是常驻的后台任务：不继承调用方的deadline，也不能被准入控制丢弃
+    try {
+        Fiber::go_system(reclaimLoop);
+    } catch (...) {
+        std::lock_guard<SpinLock> guard(rec.lock);
+        rec.running = false;
+        throw;
+    }
+}
+
+void attachConsumers(int count) {
+    if (count <= 0 || static_cast<size_t>(count) <= g_slot_count.load(std::memory_order_acquire)) {
+        return;
+    }
+    // 只在调度器初始化时扩容，旧数组可能还在被synchronize读取，不释放
+    auto *slots = new ConsumerSlot[count];
+    g_slots.store(slots, std::memory_order_release);
+    g_slot_count.store(static_cast<size_t>(count), std::memory_order_release);
+}
+
+void consumerOnline(int consumer_id) {
+    auto &slot = g_slots.load(std::memory_order_acquire)[consumer_id];
+    slot.seq.store(g_gp_seq.load(std::memory_order_acquire), std::memory_order_seq_cst);
+    // 与synchronize配对：要么synchronize看到本consumer在线，要么之后的读者看到新版本
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void consumerOffline(int consumer_id) {
+    auto &slot = g_slots.load(std::memory_order_acquire)[consumer_id];
+    slot.seq.store(kOffline, std::memory_order_release);
+}
+
+void quiescent(int consumer_id) {
+    // 有fiber挂起在读临界区内时不算静止点
+    if (detail::read_depth > 0) {
+        return;
+    }
+    auto &slot = g_slots.load(std::memory_order_relaxed)[consumer_id];
+    uint64_t gp = g_gp_seq.load(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != gp) {
+        // release：本轮迭代中读者的所有访问先于静止点对synchronize可见
+        slot.seq.store(gp, std::memory_order_release);
+    }
+}
+
+} // namespace fiber::rcu
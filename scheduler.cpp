@@ -1,17 +1,58 @@
 #include "scheduler.h"
 #include <algorithm>
 #include <cassert>
+#include <charconv>
 #include <iostream>
+#include <sstream>
+#include <string>
 #include <thread>
+#include "accounting.h"
+#include "buffer_ring.h"
 #include "fiber_consumer.h"
+#include "fiber_log.h"
+#include "hires_timer.h"
 #include "io_manager.h"
+#include "profiler.h"
+#include "rcu.h"
 #include "serika/basic/config_manager.h"
 #include "serika/basic/logger.h"
 #include "timer.h"
 
 namespace fiber {
 Scheduler::Scheduler() : state_(SchedulerState::STOPPED) {
-    init(ConfigManager::Instance().get<int>("fiber.num_consumer", 4));
+    auto &config = ConfigManager::Instance();
+    spawn_local_ = config.get<bool>("fiber.spawn_local", true);
+    high_res_timer_ = config.get<bool>("fiber.timer.high_resolution", false);
+    busy_poll_window_ = std::chrono::microseconds(config.get<int>("fiber.busy_poll.window_us", 0));
+    busy_poll_socket_us_ = config.get<int>("fiber.busy_poll.socket_us", 0);
+    buffer_ring_entries_ = config.get<int>("fiber.io.buffer_ring.entries", 1024);
+    buffer_ring_buffer_size_ = config.get<int>("fiber.io.buffer_ring.buffer_kb", 16) * 1024;
+    buffer_ring_use_uring_ = config.get<bool>("fiber.io.uring", true);
+    std::istringstream busy_poll_ids(config.get<std::string>("fiber.busy_poll.consumers", ""));
+    for (std::string id; std::getline(busy_poll_ids, id, ',');) {
+        if (id.empty()) {
+            continue;
+        }
+        // 配置写错时跳过这一项，不能让Scheduler的构造函数抛异常
+        int consumer_id = 0;
+        auto [end, ec] = std::from_chars(id.data(), id.data() + id.size(), consumer_id);
+        if (ec != std::errc() || end != id.data() + id.size()) {
+            LOG_WARN("fiber.busy_poll.consumers: invalid consumer id '{}', ignored", id);
+            continue;
+        }
+        busy_poll_consumers_.push_back(consumer_id);
+    }
+    stack_options_.huge_pages = config.get<bool>("fiber.stack.huge_pages", false);
+    stack_options_.prefault_bytes = static_cast<size_t>(config.get<int>("fiber.stack.prefault_kb", 0)) * 1024;
+    stack_options_.populate = config.get<bool>("fiber.stack.populate", false);
+    StackPool::configure(stack_options_);
+    if (config.get<bool>("fiber.accounting.enabled", false)) {
+        accounting::enable();
+    }
+    admission_enabled_ = config.get<bool>("fiber.admission.enabled", false);
+    admission_target_ = std::chrono::milliseconds(config.get<int>("fiber.admission.target_ms", 5));
+    admission_interval_ = std::chrono::milliseconds(config.get<int>("fiber.admission.interval_ms", 100));
+    init(config.get<int>("fiber.num_consumer", 4));
     // init(std::thread::hardware_concurrency());
     LOG_DEBUG("Scheduler created");
 }
@@ -33,6 +74,11 @@ void Scheduler::init(int worker_count) {
 }
 
 void Scheduler::run() {
+    if (main_loop_claimed_.exchange(true, std::memory_order_acq_rel)) {
+        // consumer 0已经在后台线程运行，等待调度器停止
+        state_.wait(SchedulerState::RUNNING, std::memory_order_acquire);
+        return;
+    }
 
     // 多线程模式
     consumers_[0]->consumerLoop();
@@ -40,6 +86,16 @@ void Scheduler::run() {
     LOG_DEBUG("Scheduler stopped");
 }
 
+void Scheduler::start() {
+    if (main_loop_claimed_.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+
+    FiberConsumer *consumer = consumers_[0].get();
+    consumer->thread_ = std::thread(&FiberConsumer::consumerLoop, consumer);
+    LOG_DEBUG("Scheduler started in background");
+}
+
 void Scheduler::stop() {
     if (state_ == SchedulerState::STOPPED) {
         return;
@@ -48,6 +104,7 @@ void Scheduler::stop() {
     state_ = SchedulerState::STOPPED;
 
     stopConsumers();
+    state_.notify_all();
 }
 
 bool Scheduler::isRunning() const { return state_ == SchedulerState::RUNNING; }
@@ -62,10 +119,10 @@ Scheduler &Scheduler::getInst() {
 }
 
 // 多线程调度方法
-void Scheduler::scheduleImmediate(const Fiber::ptr& fiber) {
+bool Scheduler::scheduleImmediate(const Fiber::ptr& fiber) {
     if (state_ != SchedulerState::RUNNING) {
         LOG_WARN("[Scheduler] pushing fiber when scheduler is not setup, loss fiber!");
-        return;
+        return false;
     }
 
     assert(fiber->getState() != FiberState::DONE &&
@@ -77,22 +134,82 @@ void Scheduler::scheduleImmediate(const Fiber::ptr& fiber) {
         while (!consumer->schedule(fiber)) {
             std::this_thread::yield();
         }
-        return;
+        return true;
     }
 
     // LOG_INFO("Scheduling fiber {}", fiber->getId());
-    for (;;) {
-        FiberConsumer *consumer = selectConsumer(fiber->GetTraceId());
+    // 尚未绑定consumer的新fiber
+    FiberConsumer *consumer = placeConsumer(fiber->GetTraceId());
+    if (!consumer) {
+        LOG_ERROR("No consumer to select, fiber lost");
+        return false;
+    }
 
-        if (!consumer) {
-            LOG_ERROR("No consumer to select, fiber lost");
-            return;
-        }
+    if (!admit(consumer, fiber)) {
+        shed(fiber);
+        return false;
+    }
+
+    consumer->spawn(fiber);
+    // LOG_INFO("Scheduled fiber:{} to consumer:{}", fiber->getId(), consumer->id());
+    return true;
+}
 
-        if (consumer->schedule(fiber)) {
-            // LOG_INFO("Scheduled fiber:{} to consumer:{}", fiber->getId(), consumer->id());
-            break;
+bool Scheduler::scheduleBatch(std::vector<Fiber::ptr> &fibers) {
+    if (fibers.empty()) {
+        return true;
+    }
+
+    if (state_ != SchedulerState::RUNNING) {
+        LOG_WARN("[Scheduler] pushing {} fibers when scheduler is not setup, loss fibers!", fibers.size());
+        return false;
+    }
+
+    // 整批放到同一个consumer，空闲consumer会从中窃取
+    FiberConsumer *consumer = placeConsumer(fibers.front()->GetTraceId());
+    if (!consumer) {
+        LOG_ERROR("No consumer to select, {} fibers lost", fibers.size());
+        return false;
+    }
+
+    // 同一批fiber由同一个调用方产生，根属性一致，整批接受或整批拒绝
+    if (!admit(consumer, fibers.front())) {
+        for (auto &fiber: fibers) {
+            shed(fiber);
         }
+        fibers.clear();
+        return false;
+    }
+
+    consumer->spawnBatch(fibers);
+    return true;
+}
+
+void Scheduler::setShedHandler(ShedHandler handler) { shed_handler_ = std::move(handler); }
+
+uint64_t Scheduler::getShedCount() const { return shed_count_.load(std::memory_order_relaxed); }
+
+void Scheduler::setBusyPoll(int consumer_id, std::chrono::microseconds window) {
+    if (consumer_id < 0 || consumer_id >= getWorkerCount()) {
+        LOG_WARN("setBusyPoll: invalid consumer id {}", consumer_id);
+        return;
+    }
+    consumers_[consumer_id]->setBusyPoll(window);
+}
+
+bool Scheduler::admit(FiberConsumer *consumer, const Fiber::ptr &fiber) const {
+    // 只拒绝新的根fiber；已接纳请求派生出的子fiber和被唤醒的fiber照常执行，让已有的工作尽快做完
+    if (!admission_enabled_ || !fiber->IsRoot()) {
+        return true;
+    }
+    return !consumer->isOverloaded();
+}
+
+void Scheduler::shed(const Fiber::ptr &fiber) {
+    fiber->discard();
+    shed_count_.fetch_add(1, std::memory_order_relaxed);
+    if (shed_handler_) {
+        shed_handler_(fiber);
     }
 }
 
@@ -116,6 +233,23 @@ TimerWheel &Scheduler::getThreadLocalTimerManager() {
     return *(consumer->timer_wheel_);
 }
 
+BufferRing &Scheduler::getThreadLocalBufferRing() {
+    auto consumer = getThreadLocalConsumer();
+    if (!consumer->buffer_ring_) {
+        auto &scheduler = Scheduler::getInst();
+        consumer->buffer_ring_.reset(new BufferRing(consumer, *consumer->io_manager_,
+                                                    static_cast<unsigned>(scheduler.buffer_ring_entries_),
+                                                    static_cast<size_t>(scheduler.buffer_ring_buffer_size_),
+                                                    scheduler.buffer_ring_use_uring_));
+    }
+    return *consumer->buffer_ring_;
+}
+
+HighResTimer *Scheduler::getThreadLocalHighResTimer() {
+    auto consumer = getThreadLocalConsumer();
+    return consumer->hires_timer_.get();
+}
+
 FiberConsumer *Scheduler::selectConsumer(uint64_t trace_id) {
     if (consumers_.empty()) {
         return nullptr;
@@ -151,15 +285,42 @@ FiberConsumer *Scheduler::selectConsumer(uint64_t trace_id) {
     return consumers_[index].get();
 }
 
+FiberConsumer *Scheduler::placeConsumer(uint64_t trace_id) {
+    // spawn local：在consumer线程上spawn时直接放入本地队列，省掉跨线程入队和eventfd写。
+    // thread-per-core模式下子fiber会和父fiber共享单线程的同步原语，必须留在同一个consumer上
+    if (spawn_local_ || !kLocalThreadSafe) {
+        FiberConsumer *local = FiberConsumer::current();
+        if (local && local->scheduler_ == this) {
+            return local;
+        }
+    }
+    return selectConsumer(trace_id);
+}
+
 void Scheduler::startConsumers(int count) {
     consumers_.clear();
 
-    consumers_.emplace_back(std::make_unique<FiberConsumer>(0, this));
+    // 先建好全部consumer再启动线程，consumer之间会互相窃取，启动后consumers_不能再变
+    for (int i = 0; i < count; ++i) {
+        consumers_.emplace_back(std::make_unique<FiberConsumer>(i, this));
+    }
+    if (busy_poll_window_.count() > 0) {
+        if (busy_poll_consumers_.empty()) {
+            for (auto &consumer: consumers_) {
+                consumer->setBusyPoll(busy_poll_window_);
+            }
+        }
+        for (int id: busy_poll_consumers_) {
+            setBusyPoll(id, busy_poll_window_);
+        }
+    }
     consumers_[0]->running_ = true;
+    rcu::attachConsumers(count);
+    accounting::attachConsumers(count);
+    log::attachConsumers(count);
+    profiler::attachConsumers(count);
     for (int i = 1; i < count; ++i) {
-        auto consumer = std::make_unique<FiberConsumer>(i, this);
-        consumer->start();
-        consumers_.push_back(std::move(consumer));
+        consumers_[i]->start();
     }
 }
 
@@ -0,0 +1,159 @@
+#include "shm_channel.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "serika/basic/logger.h"
+
+namespace fiber {
+
+namespace shm_detail {
+
+ShmChannelFds createSegment(size_t bytes) {
+    ShmChannelFds fds;
+    fds.memfd = ::memfd_create("fiber_shm_channel", MFD_CLOEXEC);
+    if (fds.memfd < 0) {
+        throw std::system_error(errno, std::system_category(), "memfd_create failed");
+    }
+
+    if (::ftruncate(fds.memfd, static_cast<off_t>(bytes)) < 0) {
+        int saved_errno = errno;
+        closeFds(fds);
+        throw std::system_error(saved_errno, std::system_category(), "ftruncate shm segment failed");
+    }
+
+    // 门铃不需要计数语义，非阻塞便于一次性读空
+    fds.data_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fds.space_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds.data_fd < 0 || fds.space_fd < 0) {
+        int saved_errno = errno;
+        closeFds(fds);
+        throw std::system_error(saved_errno, std::system_category(), "eventfd for shm doorbell failed");
+    }
+
+    return fds;
+}
+
+void *mapSegment(int memfd, size_t &bytes) {
+    struct stat st{};
+    if (::fstat(memfd, &st) < 0) {
+        throw std::system_error(errno, std::system_category(), "fstat shm segment failed");
+    }
+    bytes = static_cast<size_t>(st.st_size);
+
+    void *base = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (base == MAP_FAILED) {
+        throw std::system_error(errno, std::system_category(), "mmap shm segment failed");
+    }
+    return base;
+}
+
+void unmapSegment(void *addr, size_t bytes) {
+    if (addr && ::munmap(addr, bytes) < 0) {
+        LOG_ERROR("[ShmChannel] munmap failed: {}", strerror(errno));
+    }
+}
+
+void closeFds(const ShmChannelFds &fds) {
+    for (int fd: {fds.memfd, fds.data_fd, fds.space_fd}) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+}
+
+void ringDoorbell(int event_fd) {
+    uint64_t val = 1;
+    if (::write(event_fd, &val, sizeof(val)) != sizeof(val) && errno != EAGAIN) {
+        LOG_ERROR("[ShmChannel] ring doorbell failed: {}", strerror(errno));
+    }
+}
+
+void drainDoorbell(int event_fd) {
+    uint64_t val;
+    while (::read(event_fd, &val, sizeof(val)) == sizeof(val)) {
+    }
+}
+
+} // namespace shm_detail
+
+bool ShmChannelFds::sendTo(int unix_sock) const {
+    int fds[3] = {memfd, data_fd, space_fd};
+    char tag = 'F';
+    iovec iov{&tag, sizeof(tag)};
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    while (true) {
+        ssize_t n = ::sendmsg(unix_sock, &msg, MSG_NOSIGNAL);
+        if (n == sizeof(tag)) {
+            return true;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && IO::wait(unix_sock, POLLOUT)) {
+            continue;
+        }
+        LOG_ERROR("[ShmChannel] send fds failed: {}", strerror(errno));
+        return false;
+    }
+}
+
+std::optional<ShmChannelFds> ShmChannelFds::recvFrom(int unix_sock) {
+    int fds[3] = {-1, -1, -1};
+    char tag = 0;
+    iovec iov{&tag, sizeof(tag)};
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    while (true) {
+        ssize_t n = ::recvmsg(unix_sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n == sizeof(tag)) {
+            break;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && IO::wait(unix_sock, POLLIN)) {
+            continue;
+        }
+        LOG_ERROR("[ShmChannel] recv fds failed: {}", n == 0 ? "peer closed" : strerror(errno));
+        return std::nullopt;
+    }
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds)) || tag != 'F') {
+        LOG_ERROR("[ShmChannel] unexpected message while receiving fds");
+        if (cmsg && cmsg->cmsg_type == SCM_RIGHTS) {
+            std::memcpy(fds, CMSG_DATA(cmsg), std::min<size_t>(sizeof(fds), cmsg->cmsg_len - CMSG_LEN(0)));
+            shm_detail::closeFds(ShmChannelFds{fds[0], fds[1], fds[2]});
+        }
+        return std::nullopt;
+    }
+
+    std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    return ShmChannelFds{fds[0], fds[1], fds[2]};
+}
+
+} // namespace fiber
@@ -0,0 +1,244 @@
+#include "signals.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <pthread.h>
+#include <stdexcept>
+#include <sys/signalfd.h>
+#include <system_error>
+#include <vector>
+#include "fiber.h"
+#include "io_fiber.h"
+#include "parking_lot.h"
+#include "scheduler.h"
+#include "serika/basic/logger.h"
+#include "sync.h"
+#include "timer.h"
+#include "wait_queue.h"
+
+namespace fiber::signals {
+
+namespace {
+
+struct Waiter {
+    sigset_t set;
+    int signo{0}; // 由分发fiber在认领凭据前写入
+    WaitQueue::WaitTicket ticket;
+};
+
+// 全局状态，只在注册信号、分发信号和等待者进出时短暂持锁，临界区内不会挂起
+struct Registry {
+    SpinLock lock;
+    sigset_t mask; // 已经加入signalfd的信号
+    int signal_fd{-1};
+    std::array<uint32_t, NSIG> pending{}; // 到达时没有等待者的信号
+    std::vector<Waiter *> waiters; // 按等待先后顺序唤醒
+
+    Registry() { sigemptyset(&mask); }
+};
+
+Registry &registry() {
+    static Registry registry;
+    return registry;
+}
+
+sigset_t toSet(std::initializer_list<int> signos) {
+    sigset_t set;
+    sigemptyset(&set);
+    for (int signo: signos) {
+        sigaddset(&set, signo);
+    }
+    return set;
+}
+
+void blockInAllThreads(const sigset_t &set) {
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+    auto &scheduler = Scheduler::getInst();
+    if (!Fiber::InSchedulableFiber()) {
+        scheduler.start();
+    }
+
+    // 信号掩码是线程属性，只能在每个consumer线程上自己设置。
+    // 计数会被所有consumer修改，用std::atomic而不是WaitGroup（thread-per-core模式下WaitGroup不是线程安全的）
+    const int count = scheduler.getWorkerCount();
+    auto remaining = std::make_shared<std::atomic<int>>(count);
+    for (int i = 0; i < count; ++i) {
+        Fiber::go_system([set, remaining]() {
+            pthread_sigmask(SIG_BLOCK, &set, nullptr);
+            if (remaining->fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                fiber::notify_one(remaining.get());
+            }
+        }, i);
+    }
+    for (int left; (left = remaining->load(std::memory_order_acquire)) != 0;) {
+        fiber::wait_on(*remaining, left);
+    }
+}
+
+void dispatch(int signo) {
+    auto &reg = registry();
+    std::lock_guard<SpinLock> guard(reg.lock);
+
+    for (auto it = reg.waiters.begin(); it != reg.waiters.end(); ++it) {
+        Waiter *waiter = *it;
+        if (sigismember(&waiter->set, signo) != 1) {
+            continue;
+        }
+        waiter->signo = signo;
+        if (WaitQueue::notify(waiter->ticket)) {
+            reg.waiters.erase(it);
+            return;
+        }
+        // 已经超时，等待者自己会从列表中移除
+        waiter->signo = 0;
+    }
+
+    ++reg.pending[signo];
+}
+
+void dispatchLoop(int signal_fd) {
+    signalfd_siginfo info;
+    while (true) {
+        auto n = IO::read(signal_fd, &info, sizeof(info));
+        if (!n || *n < 0) {
+            // 只有signalfd失效才退出；其余错误（EINTR、ETIMEDOUT等）退出的话之后的信号都会丢失
+            if (errno == EBADF) {
+                LOG_ERROR("[signals] signalfd {} closed, signal dispatcher stopped", signal_fd);
+                return;
+            }
+            if (errno != EINTR && errno != ETIMEDOUT && errno != EAGAIN) {
+                LOG_WARN("[signals] read signalfd failed: {}, retrying", strerror(errno));
+                Fiber::sleep(10);
+            }
+            continue;
+        }
+        if (*n != sizeof(info)) {
+            continue;
+        }
+
+        // LOG_DEBUG("[signals] received signal {}", info.ssi_signo);
+        dispatch(static_cast<int>(info.ssi_signo));
+    }
+}
+
+} // namespace
+
+void block(const sigset_t &set) {
+    auto &reg = registry();
+
+    sigset_t added;
+    sigemptyset(&added);
+    bool any_added = false;
+    for (int signo = 1; signo < NSIG; ++signo) {
+        if (sigismember(&set, signo) != 1) {
+            continue;
+        }
+        std::lock_guard<SpinLock> guard(reg.lock);
+        if (sigismember(&reg.mask, signo) != 1) {
+            sigaddset(&added, signo);
+            any_added = true;
+        }
+    }
+    if (!any_added) {
+        return;
+    }
+
+    // 先在所有线程上阻塞，再交给signalfd，避免信号按默认动作处理
+    blockInAllThreads(added);
+
+    int new_fd = -1;
+    {
+        std::lock_guard<SpinLock> guard(reg.lock);
+        for (int signo = 1; signo < NSIG; ++signo) {
+            if (sigismember(&added, signo) == 1) {
+                sigaddset(&reg.mask, signo);
+            }
+        }
+
+        // 已有signalfd时原地更新掩码
+        int fd = ::signalfd(reg.signal_fd, &reg.mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (fd < 0) {
+            throw std::system_error(errno, std::system_category(), "signalfd failed");
+        }
+        if (reg.signal_fd < 0) {
+            reg.signal_fd = fd;
+            new_fd = fd;
+        }
+    }
+
+    if (new_fd >= 0) {
+        // 分发fiber固定在consumer 0上，signalfd只注册在这一个IOManager里；
+        // 它会一直运行，不能继承第一次调用watch的fiber的deadline
+        Fiber::go_system([new_fd]() { dispatchLoop(new_fd); }, 0);
+        LOG_DEBUG("[signals] signal dispatcher started, signalfd={}", new_fd);
+    }
+}
+
+void block(std::initializer_list<int> signos) { block(toSet(signos)); }
+
+std::optional<int> wait(const sigset_t &set, int64_t timeout_ms) {
+    if (timeout_ms > 0 && !Fiber::InSchedulableFiber()) {
+        throw std::runtime_error("signals::wait with timeout must be called from within a fiber");
+    }
+
+    block(set);
+
+    auto &reg = registry();
+    Waiter waiter;
+    waiter.set = set;
+    {
+        std::lock_guard<SpinLock> guard(reg.lock);
+        for (int signo = 1; signo < NSIG; ++signo) {
+            if (reg.pending[signo] > 0 && sigismember(&set, signo) == 1) {
+                --reg.pending[signo];
+                return signo;
+            }
+        }
+
+        if (timeout_ms == 0) {
+            errno = ETIMEDOUT;
+            return std::nullopt;
+        }
+
+        waiter.ticket = WaitQueue::make_ticket();
+        reg.waiters.push_back(&waiter);
+    }
+
+    TimerWheel::TimerPtr timer;
+    if (timeout_ms > 0) {
+        auto &timer_wheel = Scheduler::getThreadLocalTimerManager();
+        timer = timer_wheel.addTimer(
+                static_cast<uint64_t>(timeout_ms), [ticket = waiter.ticket]() mutable { WaitQueue::notify(ticket); },
+                false);
+    }
+
+    WaitQueue::commit_wait(waiter.ticket);
+
+    if (timer) {
+        Scheduler::getThreadLocalTimerManager().cancel(timer);
+    }
+
+    int signo;
+    {
+        std::lock_guard<SpinLock> guard(reg.lock);
+        auto it = std::find(reg.waiters.begin(), reg.waiters.end(), &waiter);
+        if (it != reg.waiters.end()) {
+            reg.waiters.erase(it);
+        }
+        signo = waiter.signo;
+    }
+
+    if (signo == 0) {
+        errno = ETIMEDOUT;
+        return std::nullopt;
+    }
+    return signo;
+}
+
+std::optional<int> wait(std::initializer_list<int> signos, int64_t timeout_ms) { return wait(toSet(signos), timeout_ms); }
+
+} // namespace fiber::signals
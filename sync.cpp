@@ -1,66 +1,98 @@
 #include "include/sync.h"
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include "include/fiber_consumer.h"
 #include "include/scheduler.h"
 #include "include/timer.h"
 
 namespace fiber {
 
-FiberMutex::FiberMutex() : locked_(false), waiters_(std::make_unique<WaitQueue>()) {}
+FiberMutex::FiberMutex() : state_(kUnlocked) {}
 
 FiberMutex::~FiberMutex() {
     // 确保析构时锁已释放
-    if (locked_.load(std::memory_order_acquire)) {
+    if (state_.load(std::memory_order_acquire) != kUnlocked) {
         LOG_WARN("FiberMutex destroyed while still locked!");
     }
 }
 
 void FiberMutex::lock() {
-    // 快速路径：尝试直接获取锁
-    while (!try_acquire_lock()) {
-        // 慢速路径：进入等待队列并挂起当前fiber
+    // 快速路径：无竞争时一次CAS
+    uint32_t state = kUnlocked;
+    if (state_.compare_exchange_strong(state, kLocked, std::memory_order_acquire, std::memory_order_relaxed)) {
+        return;
+    }
+
+    // 慢速路径：标记为有等待者后在锁字上挂起，被唤醒后重新抢锁
+    // 抢到锁时状态保持为kContended，unlock时会多一次notify，但不会丢失唤醒
+    const bool sampled = contention::sample();
+    const int64_t wait_start = sampled ? contention::now_ns() : 0;
+    if (state != kContended) {
+        state = state_.exchange(kContended, std::memory_order_acquire);
+    }
+    while (state != kUnlocked) {
         // LOG_DEBUG("FiberMutex::lock() - fiber waiting for lock");
-        waiters_->wait();
-        // 被唤醒后继续循环尝试获取锁
+        fiber::wait_on(state_, kContended);
+        state = state_.exchange(kContended, std::memory_order_acquire);
+    }
+
+    if (sampled) {
+        const void *site = __builtin_return_address(0);
+        const int64_t acquired = contention::now_ns();
+        contention::record_wait(this, site, std::chrono::nanoseconds(acquired - wait_start));
+        profile_acquired_ns_ = acquired;
+        profile_site_ = site;
     }
 }
 
-bool FiberMutex::try_lock() { return try_acquire_lock(); }
+bool FiberMutex::try_lock() {
+    uint32_t expected = kUnlocked;
+    return state_.compare_exchange_strong(expected, kLocked, std::memory_order_acquire, std::memory_order_relaxed);
+}
 
 void FiberMutex::unlock() {
-
-    auto current = Fiber::GetCurrentFiberPtr();
-    if (!current) {
-        throw std::system_error(std::make_error_code(std::errc::operation_not_permitted),
-                                "Attempting to unlock a mutex not owned by current fiber");
-    }
-
-    if (locked_.exchange(false, std::memory_order_release) != true) {
+    // 采样的加锁在释放前取出记录，释放后其他持锁者会覆盖这两个字段
+    const int64_t acquired = profile_acquired_ns_;
+    const void *site = profile_site_;
+    profile_acquired_ns_ = 0;
+
+    // 外部线程也可以加锁解锁，等待时挂起的是整个线程
+    uint32_t prev = state_.exchange(kUnlocked, std::memory_order_release);
+    if (prev == kUnlocked) {
         throw std::system_error(std::make_error_code(std::errc::operation_not_permitted),
                                 "Double unlock or unlock without lock");
     }
 
-    // 通知一个等待的协程（WaitQueue内部是lock-free的）
-    waiters_->notify_one();
-}
-
-bool FiberMutex::try_acquire_lock() {
-    auto current = Fiber::GetCurrentFiberPtr();
-    if (!current) {
-        LOG_ERROR("FiberMutex::try_acquire_lock() - not called from within a fiber");
-        return false;
+    // 只有可能存在等待者时才去等待表里找
+    if (prev == kContended) {
+        fiber::notify_one(&state_);
     }
-
-    // 使用CAS原子操作尝试获取锁
-    bool expected = false;
-    if (locked_.compare_exchange_strong(expected, true, std::memory_order_acquire, std::memory_order_relaxed)) {
-        // LOG_DEBUG("FiberMutex::try_acquire_lock() - lock acquired by fiber");
-        return true;
+    if (acquired != 0) {
+        contention::record_hold(this, site, std::chrono::nanoseconds(contention::now_ns() - acquired));
     }
-
-    return false;
 }
 
 // FiberCondition 实现
-FiberCondition::FiberCondition() : waiters_(std::make_unique<WaitQueue>()) {}
+namespace {
+
+// 条件变量返回（包括抛出DeadlineExceeded）时调用方必须持有锁，否则unique_lock析构时会重复unlock。
+// deadline已过时FiberMutex::lock会在挂起前抛出，重新加锁期间暂时去掉deadline
+void relock(std::unique_lock<FiberMutex> &lock) {
+    Fiber *current = Fiber::GetCurrentFiberRaw();
+    const auto deadline = current ? current->GetDeadline() : std::nullopt;
+    if (!deadline) {
+        lock.lock();
+        return;
+    }
+    current->ClearDeadline();
+    lock.lock();
+    current->SetDeadline(*deadline);
+}
+
+} // namespace
+
+FiberCondition::FiberCondition() : seq_(0) {}
 
 FiberCondition::~FiberCondition() = default;
 
@@ -70,32 +102,58 @@ void FiberCondition::wait(std::unique_lock<FiberMutex> &lock) {
                                 "Condition variable wait called without owning the lock");
     }
 
-    // 释放锁并等待通知（原子操作）
+    // 释放锁之前读取序号，释放锁之后发生的notify会改变序号，wait_on不会挂起
+    uint32_t seq = seq_.load(std::memory_order_acquire);
     lock.unlock();
 
     // LOG_DEBUG("FiberCondition::wait() - fiber waiting for condition");
-    waiters_->wait();
+    try {
+        fiber::wait_on(seq_, seq);
+    } catch (...) {
+        relock(lock);
+        throw;
+    }
 
     // 重新获取锁
-    lock.lock();
+    relock(lock);
 }
 
 void FiberCondition::notify_one() {
-    // WaitQueue内部已经是lock-free的，直接调用
-    waiters_->notify_one();
+    seq_.fetch_add(1, std::memory_order_release);
+    fiber::notify_one(&seq_);
 }
 
 void FiberCondition::notify_all() {
-    // WaitQueue内部已经是lock-free的，直接调用
-    waiters_->notify_all();
+    seq_.fetch_add(1, std::memory_order_release);
+    fiber::notify_all(&seq_);
 }
 
 // WaitGroup 实现
-WaitGroup::WaitGroup() : counter_(0), waiters_(std::make_unique<WaitQueue>()) {}
+// 分片会被其他consumer搬运，thread-per-core模式下也必须是真正的原子变量
+struct alignas(CACHE_LINE_SIZE) WaitGroup::Shard {
+    std::atomic<int64_t> count{0}; // 分片持有的未完成计数，始终非负
+};
+
+WaitGroup::WaitGroup(Mode mode) : counter_(0) {
+    // thread-per-core模式下WaitGroup只在一个consumer上使用，分片没有意义，counter_也不是原子的
+    if (kLocalThreadSafe && mode == Mode::Sharded) {
+        shard_count_ = static_cast<size_t>(std::max(1, Scheduler::getInst().getWorkerCount()));
+        shards_ = std::make_unique<Shard[]>(shard_count_);
+    }
+}
 
 WaitGroup::~WaitGroup() = default;
 
 void WaitGroup::add(int delta) {
+    if (shards_) {
+        if (delta > 0) {
+            shardDeposit(shards_[localShard()], delta);
+        } else if (delta < 0) {
+            shardedDone(-static_cast<int64_t>(delta));
+        }
+        return;
+    }
+
     // 使用fetch_add原子操作更新计数器
     int old_count = counter_.fetch_add(delta, std::memory_order_acq_rel);
     int new_count = old_count + delta;
@@ -109,35 +167,231 @@ void WaitGroup::add(int delta) {
     // LOG_DEBUG("WaitGroup::add({}) - counter: {} -> {}", delta, old_count, new_count);
 
     // 如果计数器归零，通知所有等待者
+    // 等待者可能已经返回并析构了WaitGroup，notify_all只用地址查表，不访问对象本身
     if (new_count == 0) {
-        notify_waiters_if_done();
+        // LOG_DEBUG("WaitGroup::add() - notifying all waiters");
+        fiber::notify_all(&counter_);
     }
 }
 
 void WaitGroup::done() { add(-1); }
 
 void WaitGroup::wait() {
-    // 快速路径：如果已经完成，直接返回
-    if (counter_.load(std::memory_order_acquire) == 0) {
+    // 计数变化但未归零时不会有notify，wait_on发现值已变化会立即返回，按新值重新等待
+    int count;
+    while ((count = counter_.load(std::memory_order_acquire)) != 0) {
+        // LOG_DEBUG("WaitGroup::wait() - waiting for counter to reach zero");
+        fiber::wait_on(counter_, count);
+    }
+}
+
+int WaitGroup::count() const {
+    if (!shards_) {
+        return counter_.load(std::memory_order_acquire);
+    }
+
+    int64_t sum = 0;
+    for (size_t i = 0; i < shard_count_; ++i) {
+        sum += shards_[i].count.load(std::memory_order_relaxed);
+    }
+    return static_cast<int>(sum);
+}
+
+size_t WaitGroup::localShard() const {
+    if (auto *consumer = FiberConsumer::current()) {
+        return static_cast<size_t>(consumer->id()) % shard_count_;
+    }
+    // 外部线程按线程id分散到各分片
+    return std::hash<std::thread::id>{}(std::this_thread::get_id()) % shard_count_;
+}
+
+void WaitGroup::shardDeposit(Shard &shard, int64_t n) {
+    int64_t current = shard.count.load(std::memory_order_acquire);
+    while (true) {
+        if (current == 0) {
+            // 分片由零变非零：先登记再存入，counter_不会在分片还有计数时归零
+            counter_.fetch_add(1, std::memory_order_acq_rel);
+            if (shard.count.compare_exchange_strong(current, n, std::memory_order_acq_rel,
+                                                    std::memory_order_acquire)) {
+                return;
+            }
+            // 其他线程抢先让分片变为非零，它的登记还在，撤销自己的登记不会让counter_归零
+            releaseActive();
+            continue;
+        }
+        if (shard.count.compare_exchange_weak(current, current + n, std::memory_order_acq_rel,
+                                              std::memory_order_acquire)) {
+            return;
+        }
+    }
+}
+
+int64_t WaitGroup::shardWithdraw(Shard &shard, int64_t n) {
+    int64_t current = shard.count.load(std::memory_order_acquire);
+    while (current > 0) {
+        int64_t taken = std::min(current, n);
+        if (shard.count.compare_exchange_weak(current, current - taken, std::memory_order_acq_rel,
+                                              std::memory_order_acquire)) {
+            if (taken == current) {
+                releaseActive(); // 分片归零，折叠到counter_
+            }
+            return taken;
+        }
+    }
+    return 0;
+}
+
+void WaitGroup::shardedDone(int64_t n) {
+    const size_t self = localShard();
+    Shard &local = shards_[self];
+
+    // 快速路径：只修改本consumer的分片
+    const int64_t requested = n;
+    n -= shardWithdraw(local, n);
+    if (n == 0) {
         return;
     }
 
-    // LOG_DEBUG("WaitGroup::wait() - waiting for counter to reach zero");
+    // 子任务被其他consumer窃取执行时本地分片没有计数，需要从其他分片搬运。
+    // 搬运期间先占住counter_，源分片归零和存入本地分片之间counter_不会提前归零
+    counter_.fetch_add(1, std::memory_order_acq_rel);
+    while (n > 0) {
+        // 记下扫描前的搬运状态：扫描期间没有额度在分片之间移动时，全部为零才说明计数确实不足
+        const uint64_t migrations = migrations_.load(std::memory_order_acquire);
+        const bool migrating = migrating_.load(std::memory_order_acquire) != 0;
+        bool found = false;
+        for (size_t i = 1; i <= shard_count_ && n > 0; ++i) {
+            Shard &shard = shards_[(self + i) % shard_count_];
+            int64_t available = shard.count.load(std::memory_order_acquire);
+            if (available <= 0) {
+                continue;
+            }
+
+            // 多搬一半剩余计数到本地分片，本consumer后续的done不再跨核
+            int64_t extra = &shard == &local ? 0 : (available - std::min(available, n)) / 2;
+            if (extra > 0) {
+                migrations_.fetch_add(1, std::memory_order_acq_rel);
+                migrating_.fetch_add(1, std::memory_order_acq_rel);
+            }
+            int64_t taken = shardWithdraw(shard, n + extra);
+            if (taken > n) {
+                shardDeposit(local, taken - n);
+            }
+            if (extra > 0) {
+                migrating_.fetch_sub(1, std::memory_order_release);
+            }
+            if (taken == 0) {
+                continue;
+            }
+            found = true;
+            n -= std::min(taken, n);
+        }
+
+        if (!found) {
+            if (!migrating && migrating_.load(std::memory_order_acquire) == 0 &&
+                migrations_.load(std::memory_order_acquire) == migrations) {
+                // done多于add：归还已扣除的部分后报错，并发的多个过量done各自报错而不是互相等待
+                if (requested > n) {
+                    shardDeposit(local, requested - n);
+                }
+                releaseActive();
+                throw std::invalid_argument("WaitGroup counter cannot be negative");
+            }
+            std::this_thread::yield();
+        }
+    }
+    releaseActive();
+}
+
+void WaitGroup::releaseActive() {
+    if (counter_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        fiber::notify_all(&counter_);
+    }
+}
 
-    // 进入等待队列，挂起当前fiber
-    waiters_->wait();
+// ==================== MCSLock 实现 ====================
 
-    // 注意：由于可能有spurious wakeup（虚假唤醒），被唤醒后需要再次检查
-    // 但是由于我们的实现保证只在counter==0时才notify_all，所以这里不需要循环
+namespace {
+
+// 线程本地的MCS节点缓存：节点在unlock之后就不再被其他线程引用，可以立即复用
+struct McsNodeCache {
+    MCSLock::Node *free_list{nullptr};
+
+    ~McsNodeCache() {
+        while (free_list) {
+            MCSLock::Node *node = free_list;
+            free_list = node->free_next;
+            delete node;
+        }
+    }
+
+    MCSLock::Node *acquire() {
+        MCSLock::Node *node = free_list;
+        if (node) {
+            free_list = node->free_next;
+        } else {
+            node = new MCSLock::Node();
+        }
+        node->next.store(nullptr, std::memory_order_relaxed);
+        node->waiting.store(true, std::memory_order_relaxed);
+        return node;
+    }
+
+    void release(MCSLock::Node *node) {
+        node->free_next = free_list;
+        free_list = node;
+    }
+};
+
+thread_local McsNodeCache t_mcs_nodes;
+
+} // namespace
+
+void MCSLock::lock() noexcept {
+    Node *node = t_mcs_nodes.acquire();
+    Node *prev = tail_.exchange(node, std::memory_order_acq_rel);
+    if (prev) {
+        // 挂到前驱后面，之后只在自己的节点上自旋，等前驱直接交接
+        prev->next.store(node, std::memory_order_release);
+        uint32_t spins = 0;
+        while (node->waiting.load(std::memory_order_acquire)) {
+            cpu_relax();
+            if (++spins > kMaxSpins) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    holder_ = node;
 }
 
-int WaitGroup::count() const { return counter_.load(std::memory_order_acquire); }
+bool MCSLock::try_lock() noexcept {
+    Node *node = t_mcs_nodes.acquire();
+    Node *expected = nullptr;
+    if (tail_.compare_exchange_strong(expected, node, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+        holder_ = node;
+        return true;
+    }
+    t_mcs_nodes.release(node);
+    return false;
+}
 
-void WaitGroup::notify_waiters_if_done() {
-    if (counter_.load(std::memory_order_acquire) == 0) {
-        // LOG_DEBUG("WaitGroup::notify_waiters_if_done() - notifying all waiters");
-        waiters_->notify_all();
+void MCSLock::unlock() noexcept {
+    // 交接之后holder_会被后继覆盖，先取出自己的节点
+    Node *node = holder_;
+    Node *next = node->next.load(std::memory_order_acquire);
+    if (!next) {
+        // 没有后继：把tail_恢复为空；失败说明有后继正在入队，等它挂上来
+        Node *expected = node;
+        if (tail_.compare_exchange_strong(expected, nullptr, std::memory_order_release, std::memory_order_relaxed)) {
+            t_mcs_nodes.release(node);
+            return;
+        }
+        while (!(next = node->next.load(std::memory_order_acquire))) {
+            cpu_relax();
+        }
     }
+    next->waiting.store(false, std::memory_order_release);
+    t_mcs_nodes.release(node);
 }
 
 // ==================== FiberCondition wait_for 实现 ====================
@@ -158,50 +412,26 @@ bool FiberCondition::wait_for<int64_t, std::milli>(std::unique_lock<FiberMutex>
     }
 
     // 获取当前协程
-    auto current_fiber = Fiber::GetCurrentFiberPtr();
-    if (!current_fiber) {
+    if (!Fiber::InSchedulableFiber()) {
         throw std::runtime_error("wait_for must be called from within a fiber");
     }
 
-    // 创建共享状态
-    auto timeout_state = std::make_shared<std::atomic<bool>>(false);
-    auto notified_state = std::make_shared<std::atomic<bool>>(false);
-
-    // 添加定时器 - 定时器到期时标记超时并唤醒fiber
-    auto &timer_wheel = Scheduler::getThreadLocalTimerManager();
-    auto timer = timer_wheel.addTimer(
-            static_cast<uint64_t>(ms.count()),
-            [timeout_state, notified_state, waiters = waiters_.get()]() {
-                // 超时了，先标记超时
-                timeout_state->store(true, std::memory_order_release);
-                // 检查是否已被notify
-                if (!notified_state->exchange(true, std::memory_order_acq_rel)) {
-                    // 没被notify过，通过waitqueue唤醒fiber
-                    waiters->notify_one();
-                }
-                // 如果已被notify，什么都不做（fiber已经被唤醒）
-            },
-            false);
-
-    // 释放锁，添加到等待队列并挂起
+    // 释放锁之前读取序号，超时由wait_on在等待表里处理
+    uint32_t seq = seq_.load(std::memory_order_acquire);
     lock.unlock();
-    waiters_->wait();
-
-    // 被唤醒了，立即标记为已notify并取消定时器（避免竞争）
-    bool was_notified = !notified_state->exchange(true, std::memory_order_acq_rel);
-    if (was_notified) {
-        // 是notify唤醒的，立即取消定时器，防止定时器在协程完成后触发
-        timer_wheel.cancel(timer);
+    bool notified;
+    try {
+        notified = fiber::wait_on(seq_, seq, ms.count());
+    } catch (...) {
+        relock(lock);
+        throw;
     }
 
-    // 读取超时状态
-    bool timed_out = timeout_state->load(std::memory_order_acquire);
-
     // 重新获取锁
-    lock.lock();
+    relock(lock);
 
     // 返回是否超时
-    return !timed_out;
+    return notified;
 }
 
 } // namespace fiber
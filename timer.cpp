@@ -4,6 +4,7 @@
 
 #include "timer.h"
 #include <algorithm>
+#include "probes.h"
 #include "serika/basic/logger.h"
 
 namespace fiber {
@@ -69,11 +70,34 @@ TimerWheel::TimerPtr TimerWheel::addTimer(uint64_t ms, Callback cb, bool repeat)
     return timer;
 }
 
+TimerWheel::TimerPtr TimerWheel::addIdleTimer(uint64_t ms, Callback cb) {
+    if (!running_.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+
+    auto timer = std::make_shared<TimerNode>(Duration(ms), std::move(cb), false);
+    timer->idle = true;
+    timer->last_active.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    pending_timers_.push_back_lockfree(timer);
+    return timer;
+}
+
+void TimerWheel::touch(const TimerPtr &timer) {
+    if (timer) {
+        timer->last_active.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    }
+}
+
 TimerWheel::TimerPtr TimerWheel::refresh(TimerPtr timer) {
     if (!timer || timer->canceled.load(std::memory_order_acquire)) {
         return nullptr;
     }
 
+    if (timer->idle) {
+        touch(timer);
+        return timer;
+    }
+
     // 取消旧timer
     timer->canceled.store(true, std::memory_order_release);
 
@@ -92,6 +116,7 @@ void TimerWheel::triggerNow(TimerPtr timer) {
 
     // 执行回调
     if (timer->callback) {
+        FIBER_PROBE1(timer_fire, timer.get());
         try {
             timer->callback();
         } catch (const std::exception &e) {
@@ -104,6 +129,7 @@ void TimerWheel::triggerNow(TimerPtr timer) {
 
 void TimerWheel::cancel(TimerPtr timer) {
     if (timer) {
+        FIBER_PROBE1(timer_cancel, timer.get());
         timer->canceled.store(true, std::memory_order_release);
     }
 }
@@ -143,8 +169,30 @@ void TimerWheel::tick() {
             continue;
         }
 
+        // 空闲定时器期间有过活动，按剩余时间顺延
+        if (timer->idle) {
+            auto remaining = idleRemaining(*timer, now);
+            if (remaining.count() > 0) {
+                // 向上取整，避免提前到期后再重复顺延
+                uint64_t ticks = (remaining.count() + tick_interval_.count() - 1) / tick_interval_.count();
+                size_t target_slot = (current_slot_ + ticks) % slots_;
+                timer->rotations = ticks / slots_;
+
+                if (target_slot != current_slot_) {
+                    wheel_[target_slot].push_back(timer);
+                    it = bucket.erase(it);
+                } else {
+                    // 整轮的延迟，留在当前slot，下一次经过时已经算过一轮
+                    timer->rotations--;
+                    ++it;
+                }
+                continue;
+            }
+        }
+
         // 到期了，执行回调
         if (timer->callback) {
+            FIBER_PROBE1(timer_fire, timer.get());
             try {
                 timer->callback();
             } catch (const std::exception &e) {
@@ -189,6 +237,15 @@ void TimerWheel::tick() {
     last_tick_time_ = now;
 }
 
+TimerWheel::Duration TimerWheel::idleRemaining(const TimerNode &timer, TimePoint now) {
+    TimePoint last_active{Clock::duration(timer.last_active.load(std::memory_order_relaxed))};
+    auto idle_for = std::chrono::duration_cast<Duration>(now - last_active);
+    if (idle_for >= timer.timeout) {
+        return Duration::zero();
+    }
+    return timer.timeout - idle_for;
+}
+
 void TimerWheel::processPendingTimers() {
     TimerPtr timer;
     int processed = 0;
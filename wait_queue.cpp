@@ -2,20 +2,52 @@
 #include <cassert>
 #include <iostream>
 #include <stdexcept>
+#include "fiber_consumer.h"
 #include "scheduler.h"
 
 namespace fiber {
 
+std::shared_ptr<ThreadParker> ThreadParker::current() {
+    static thread_local auto parker = std::make_shared<ThreadParker>();
+    return parker;
+}
+
+void ThreadParker::park() {
+    // futex等待，直到拿到许可
+    while (permit_.exchange(0, std::memory_order_acquire) == 0) {
+        permit_.wait(0, std::memory_order_acquire);
+    }
+}
+
+void ThreadParker::unpark() {
+    permit_.store(1, std::memory_order_release);
+    permit_.notify_one();
+}
+
+void WaitQueue::checkWaitContext() {
+    if (!Fiber::InSchedulableFiber() && FiberConsumer::current()) {
+        std::cerr << "ERROR: wait() called from consumer scheduling loop" << std::endl;
+        throw std::runtime_error("wait() must be called from within a fiber or a non-consumer thread");
+    }
+    // 挂起点：deadline已过的fiber不再挂起，直接取消
+    Fiber::CheckDeadline();
+}
+
 // 入队前，检查ready earlyreturn即可；入队后，把block yield改成普通yield，notify检查测只对block的fiber生效
 // 可能会有竞态问题，暂时先不管了，以后再修吧
 void WaitQueue::wait() {
-    // 获取当前协程的shared_ptr
-    auto current_fiber = Fiber::GetCurrentFiberPtr();
-    if (!current_fiber) {
-        std::cerr << "ERROR: wait() called outside of fiber context" << std::endl;
-        throw std::runtime_error("wait() must be called from within a fiber");
+    checkWaitContext();
+
+    if (!Fiber::InSchedulableFiber()) {
+        // 外部线程：挂起整个线程，notify时直接唤醒
+        auto parker = ThreadParker::current();
+        lock_free_queue_.push_back_lockfree(WaitTicket{nullptr, parker, nullptr});
+        parker->park();
+        return;
     }
 
+    // 获取当前协程的shared_ptr
+    auto current_fiber = Fiber::GetCurrentFiberPtr();
 
     // 无锁添加到等待队列
     push_back_lockfree(current_fiber);
@@ -28,46 +60,100 @@ void WaitQueue::wait() {
     // std::cout << "DEBUG: Fiber " << current_fiber->getId() << " resumed from wait queue (lockfree)" << std::endl;
 }
 
-bool WaitQueue::notify_one() {
-    // 无锁从队列头部取出一个协程
-    auto fiber = pop_front_lockfree();
+WaitQueue::WaitTicket WaitQueue::make_ticket() {
+    checkWaitContext();
 
-    if (!fiber) {
-        return false; // 队列为空
+    WaitTicket ticket{nullptr, nullptr, std::make_shared<std::atomic<bool>>(false)};
+    if (Fiber::InSchedulableFiber()) {
+        ticket.fiber = Fiber::GetCurrentFiberPtr();
+    } else {
+        ticket.parker = ThreadParker::current();
     }
+    return ticket;
+}
 
-    // 获取调度器并重新调度协程
-    auto &&scheduler = Scheduler::getInst();
-    scheduler.scheduleImmediate(fiber);
-    // std::cout << "DEBUG: Notified and rescheduled waiting fiber (lockfree)" << std::endl;
+WaitQueue::WaitTicket WaitQueue::prepare_wait() {
+    WaitTicket ticket = make_ticket();
+    prepare_wait(ticket);
+    return ticket;
+}
 
-    return true;
+void WaitQueue::prepare_wait(const WaitTicket &ticket) {
+    lock_free_queue_.push_back_lockfree(ticket);
+    // 与notify一侧的fence配对：入队之后再检查的条件，一定能看到notify之前的修改
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void WaitQueue::commit_wait(WaitTicket &ticket) {
+    if (ticket.parker) {
+        ticket.parker->park();
+    } else {
+        // notify可能已经把fiber投递回运行队列，fiber绑定了本consumer，只会在这次block_yield之后才被resume
+        Fiber::block_yield();
+    }
+}
+
+bool WaitQueue::cancel_wait(WaitTicket &ticket) {
+    // 队列里留下的节点会在之后的notify中被跳过
+    return !ticket.claimed->exchange(true, std::memory_order_acq_rel);
+}
+
+bool WaitQueue::notify_one() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // 无锁从队列头部取出一个等待者，跳过已经撤销的
+    while (auto waiter = pop_front_lockfree()) {
+        if (notify(*waiter)) {
+            // std::cout << "DEBUG: Notified and rescheduled waiting fiber (lockfree)" << std::endl;
+            return true;
+        }
+    }
+
+    return false; // 队列为空
 }
 
 std::size_t WaitQueue::notify_all() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
     std::size_t count = 0;
-    auto &&scheduler = Scheduler::getInst();
 
-    // 持续取出所有等待的协程
-    while (auto fiber = pop_front_lockfree()) {
-        scheduler.scheduleImmediate(fiber);
-        count++;
+    // 持续取出所有等待者
+    while (auto waiter = pop_front_lockfree()) {
+        if (notify(*waiter)) {
+            count++;
+        }
         // std::cout << "DEBUG: Notified waiting fiber (notify_all, lockfree)" << std::endl;
     }
 
     return count;
 }
 
-void WaitQueue::push_back_lockfree(Fiber::ptr fiber) { lock_free_queue_.push_back_lockfree(fiber); }
+void WaitQueue::push_back_lockfree(Fiber::ptr fiber) {
+    lock_free_queue_.push_back_lockfree(WaitTicket{std::move(fiber), nullptr, nullptr});
+}
 
-Fiber::ptr WaitQueue::pop_front_lockfree() {
+std::optional<WaitQueue::WaitTicket> WaitQueue::pop_front_lockfree() {
     // Fiber::ptr out;
     // if (lock_free_queue_.pop_front_lockfree(out)) {
     //     return out;
     // }
     // return nullptr;
 
-    return lock_free_queue_.pop_front_lockfree().value_or(nullptr);
+    return lock_free_queue_.pop_front_lockfree();
+}
+
+bool WaitQueue::notify(WaitTicket &waiter) {
+    if (waiter.claimed && waiter.claimed->exchange(true, std::memory_order_acq_rel)) {
+        return false; // 等待者已经撤销，或已被其他队列唤醒
+    }
+
+    if (waiter.parker) {
+        waiter.parker->unpark();
+        return true;
+    }
+
+    // 获取调度器并重新调度协程，fiber已绑定consumer，外部线程调用时会通过eventfd唤醒该consumer
+    auto &&scheduler = Scheduler::getInst();
+    scheduler.scheduleImmediate(waiter.fiber);
+    return true;
 }
 
 } // namespace fiber